@@ -22,18 +22,48 @@
  */
 
 #include <linux/acpi.h>
+#include <linux/atomic.h>
+#include <linux/bpf.h>
 #include <linux/bitops.h>
+#include <linux/btf.h>
+#include <linux/btf_ids.h>
+#include <linux/completion.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/devm-helpers.h>
 #include <linux/dev_printk.h>
 #include <linux/dmi.h>
+#include <linux/hrtimer.h>
 #include <linux/hwmon.h>
+#include <linux/iio/buffer.h>
+#include <linux/iio/iio.h>
+#include <linux/iio/trigger_consumer.h>
+#include <linux/iio/triggered_buffer.h>
 #include <linux/init.h>
 #include <linux/jiffies.h>
 #include <linux/kernel.h>
+#include <linux/kref.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/perf_event.h>
 #include <linux/platform_device.h>
-#include <linux/sort.h>
+#include <linux/regmap.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/seqlock.h>
+#include <linux/sizes.h>
+#include <linux/slab.h>
+#include <linux/string_helpers.h>
+#include <linux/thermal.h>
 #include <linux/units.h>
 #include <linux/version.h>
+#include <linux/wait_bit.h>
+#include <linux/workqueue.h>
+
+#include <net/genetlink.h>
+
+#include "asus-ec-sensors.h"
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(6,12,0)
 #include <asm/unaligned.h>
@@ -41,16 +71,58 @@
 #include <linux/unaligned.h>
 #endif
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,2,0)
+#define raw_read_seqcount_latch_retry(s, start) \
+	read_seqcount_retry(&(s)->seqcount, start)
+#define get_random_u32_below prandom_u32_max
+
+static unsigned long find_nth_bit(const unsigned long *addr,
+				  unsigned long size, unsigned long n)
+{
+	unsigned long bit;
+
+	for_each_set_bit(bit, addr, size)
+		if (!n--)
+			return bit;
+	return size;
+}
+#endif
+
 static char *mutex_path_override;
+static bool release_lock_per_bank;
+static unsigned int lock_benchmark_loops;
+static bool detect_absent_sensors;
+static unsigned int presence_recheck_interval = 60;
+static unsigned long enabled_sensors = ULONG_MAX;
+static bool enable_iio;
+static unsigned int sample_period_ms;
+static bool derived_sensors;
+static unsigned int average_shift;
+static unsigned int history_bytes;
+static bool histograms;
+static bool thermal_zones;
+static unsigned int thermal_polling_ms;
+static bool perf_pmu;
+static unsigned int ec_transactions_per_sec;
+static bool adaptive_phase;
+static unsigned int refresh_budget_us;
 
 /* Writing to this EC register switches EC bank */
 #define ASUS_EC_BANK_REGISTER	0xff
+#define ASUS_EC_BANK_SIZE	0x100
 #define SENSOR_LABEL_LEN	16
 
 /*
- * Arbitrary set max. allowed bank number. Required for sorting banks and
- * currently is overkill with just 2 banks used at max, but for the sake
- * of alignment let's set it to a higher value.
+ * Banked registers are mapped into the regmap address space starting from
+ * this address, one ASUS_EC_BANK_SIZE page per bank. Addresses below it
+ * are the physical EC registers, of which only the bank register is used.
+ */
+#define ASUS_EC_REGMAP_BANKED_BASE	ASUS_EC_BANK_SIZE
+
+/*
+ * Arbitrary set max. allowed bank number. Defines the size of the banked
+ * register map and currently is overkill with just 2 banks used at max,
+ * but for the sake of alignment let's set it to a higher value.
  */
 #define ASUS_EC_MAX_BANK	3
 
@@ -65,9 +137,61 @@ static char *mutex_path_override;
 
 #define MAX_IDENTICAL_BOARD_VARIATIONS	3
 
+/* Value of temperature registers of unconnected sensor headers */
+#define ASUS_EC_SENSOR_BLANK_VALUE	216
+
+/* Limits for burst captures, see asus_ec_capture_write() */
+#define ASUS_EC_CAPTURE_MAX_SAMPLES	65536
+#define ASUS_EC_CAPTURE_MAX_PERIOD_US	USEC_PER_SEC
+#define ASUS_EC_CAPTURE_SLACK_US	50
+
+/* keeps the fixed point moving averages of s32 values within s64 */
+#define ASUS_EC_MAX_AVERAGE_SHIFT	16
+
+/* Sensor history, see asus_ec_history_add() */
+#define ASUS_EC_HISTORY_MIN_BYTES	64
+#define ASUS_EC_HISTORY_MAX_BYTES	SZ_1M
+#define ASUS_EC_HISTORY_MINUTES		60
+#define ASUS_EC_HISTORY_HOURS		24
+/* a raw record: time and value deltas, up to 5 bytes each as varints */
+#define ASUS_EC_HISTORY_MAX_RECORD	10
+
+/* Value histograms, see histogram_ranges */
+#define ASUS_EC_HISTOGRAM_BUCKETS	32
+
+/* Adaptive sampling phase, see asus_ec_adapt_phase() */
+#define ASUS_EC_PHASE_SLOTS		8
+/* samples per evaluation of the collision rate */
+#define ASUS_EC_PHASE_WINDOW		64
+/* collision rate that makes the sampler move, 1/N */
+#define ASUS_EC_PHASE_MAX_RATE		32
+/* slot statistics are halved after that many samples, to follow changes */
+#define ASUS_EC_PHASE_HISTORY		1024
+/* acquiring the hardware lock for longer means firmware held it */
+#define ASUS_EC_LOCK_WAIT_SLOW_NS	(100 * NSEC_PER_USEC)
+
+/* failed refreshes in a row after which the cached sensor value is dropped */
+#define ASUS_EC_SENSOR_MAX_FAILURES	3
+
+#define ASUS_EC_MAX_THERMAL_TRIPS	4
+#define ASUS_EC_THERMAL_HYSTERESIS	(2 * MILLIDEGREE_PER_DEGREE)
+
+static int thermal_trips[ASUS_EC_MAX_THERMAL_TRIPS];
+static unsigned int nr_thermal_trips;
+
+/* How many times to read sensors when looking for unconnected ones */
+#define ASUS_EC_PRESENCE_SAMPLES	3
+#define ASUS_EC_PRESENCE_SAMPLE_DELAY_MS	100
+
 /* Moniker for the ACPI global lock (':' is not allowed in ASL identifiers) */
 #define ACPI_GLOBAL_LOCK_PSEUDO_PATH	":GLOBAL_LOCK"
 
+/*
+ * Moniker for boards whose firmware is known not to access the banked EC
+ * registers: only a driver-local mutex is used then
+ */
+#define LOCAL_LOCK_PSEUDO_PATH	":NONE"
+
 typedef union {
 	u32 value;
 	struct {
@@ -82,12 +206,31 @@ typedef union {
 		.value = (size << 16) + (bank << 8) + index                    \
 	}
 
-static u32 hwmon_attributes[hwmon_max] = {
-	[hwmon_chip] = HWMON_C_REGISTER_TZ,
-	[hwmon_temp] = HWMON_T_INPUT | HWMON_T_LABEL,
-	[hwmon_in] = HWMON_I_INPUT | HWMON_I_LABEL,
-	[hwmon_curr] = HWMON_C_INPUT | HWMON_C_LABEL,
-	[hwmon_fan] = HWMON_F_INPUT | HWMON_F_LABEL,
+/* Attributes of the hwmon channels of each type, see DEFINE_EC_BOARD() */
+#define EC_HWMON_CONFIG_temp	(HWMON_T_INPUT | HWMON_T_LABEL | HWMON_T_ENABLE)
+#define EC_HWMON_CONFIG_in	(HWMON_I_INPUT | HWMON_I_LABEL |		\
+				 HWMON_I_ENABLE | HWMON_I_AVERAGE)
+#define EC_HWMON_CONFIG_curr	(HWMON_C_INPUT | HWMON_C_LABEL |		\
+				 HWMON_C_ENABLE | HWMON_C_AVERAGE)
+#define EC_HWMON_CONFIG_fan	(HWMON_F_INPUT | HWMON_F_LABEL | HWMON_F_ENABLE)
+#define EC_HWMON_CONFIG_power	(HWMON_P_INPUT | HWMON_P_LABEL)
+#define EC_HWMON_CONFIG_energy	(HWMON_E_INPUT | HWMON_E_LABEL)
+
+/* Attributes of channels computed from other sensors */
+#define EC_HWMON_DERIVED_CONFIG_temp	(HWMON_T_INPUT | HWMON_T_LABEL)
+#define EC_HWMON_DERIVED_CONFIG_in	0
+#define EC_HWMON_DERIVED_CONFIG_curr	0
+#define EC_HWMON_DERIVED_CONFIG_fan	0
+#define EC_HWMON_DERIVED_CONFIG_power	(HWMON_P_INPUT | HWMON_P_LABEL)
+#define EC_HWMON_DERIVED_CONFIG_energy	(HWMON_E_INPUT | HWMON_E_LABEL)
+
+static const char *const sensor_type_names[hwmon_max] = {
+	[hwmon_temp] = "temp",
+	[hwmon_in] = "in",
+	[hwmon_curr] = "curr",
+	[hwmon_fan] = "fan",
+	[hwmon_power] = "power",
+	[hwmon_energy] = "energy",
 };
 
 struct ec_sensor_info {
@@ -101,49 +244,47 @@ struct ec_sensor_info {
 		.addr = MAKE_SENSOR_ADDRESS(size, bank, index),                \
 	}
 
+/* Sensor ids of the public interface, see asus-ec-sensors.h */
 enum ec_sensors {
-	/* chipset temperature [℃] */
-	ec_sensor_temp_chipset,
-	/* CPU temperature [℃] */
-	ec_sensor_temp_cpu,
-	/* CPU package temperature [℃] */
-	ec_sensor_temp_cpu_package,
-	/* motherboard temperature [℃] */
-	ec_sensor_temp_mb,
-	/* "T_Sensor" temperature sensor reading [℃] */
-	ec_sensor_temp_t_sensor,
-	/* VRM temperature [℃] */
-	ec_sensor_temp_vrm,
-	/* CPU Core voltage [mV] */
-	ec_sensor_in_cpu_core,
-	/* CPU_Opt fan [RPM] */
-	ec_sensor_fan_cpu_opt,
-	/* VRM heat sink fan [RPM] */
-	ec_sensor_fan_vrm_hs,
-	/* Chipset fan [RPM] */
-	ec_sensor_fan_chipset,
-	/* Water flow sensor reading [RPM] */
-	ec_sensor_fan_water_flow,
-	/* CPU current [A] */
-	ec_sensor_curr_cpu,
-	/* "Water_In" temperature sensor reading [℃] */
-	ec_sensor_temp_water_in,
-	/* "Water_Out" temperature sensor reading [℃] */
-	ec_sensor_temp_water_out,
-	/* "Water_Block_In" temperature sensor reading [℃] */
-	ec_sensor_temp_water_block_in,
-	/* "Water_Block_Out" temperature sensor reading [℃] */
-	ec_sensor_temp_water_block_out,
-	/* "T_sensor_2" temperature sensor reading [℃] */
-	ec_sensor_temp_t_sensor_2,
-	/* "Extra_1" temperature sensor reading [℃] */
-	ec_sensor_temp_sensor_extra_1,
-	/* "Extra_2" temperature sensor reading [℃] */
-	ec_sensor_temp_sensor_extra_2,
-	/* "Extra_3" temperature sensor reading [℃] */
-	ec_sensor_temp_sensor_extra_3,
+	ec_sensor_temp_chipset = ASUS_EC_SENSOR_TEMP_CHIPSET,
+	ec_sensor_temp_cpu = ASUS_EC_SENSOR_TEMP_CPU,
+	ec_sensor_temp_cpu_package = ASUS_EC_SENSOR_TEMP_CPU_PACKAGE,
+	ec_sensor_temp_mb = ASUS_EC_SENSOR_TEMP_MB,
+	ec_sensor_temp_t_sensor = ASUS_EC_SENSOR_TEMP_T_SENSOR,
+	ec_sensor_temp_vrm = ASUS_EC_SENSOR_TEMP_VRM,
+	ec_sensor_in_cpu_core = ASUS_EC_SENSOR_IN_CPU_CORE,
+	ec_sensor_fan_cpu_opt = ASUS_EC_SENSOR_FAN_CPU_OPT,
+	ec_sensor_fan_vrm_hs = ASUS_EC_SENSOR_FAN_VRM_HS,
+	ec_sensor_fan_chipset = ASUS_EC_SENSOR_FAN_CHIPSET,
+	ec_sensor_fan_water_flow = ASUS_EC_SENSOR_FAN_WATER_FLOW,
+	ec_sensor_curr_cpu = ASUS_EC_SENSOR_CURR_CPU,
+	ec_sensor_temp_water_in = ASUS_EC_SENSOR_TEMP_WATER_IN,
+	ec_sensor_temp_water_out = ASUS_EC_SENSOR_TEMP_WATER_OUT,
+	ec_sensor_temp_water_block_in = ASUS_EC_SENSOR_TEMP_WATER_BLOCK_IN,
+	ec_sensor_temp_water_block_out = ASUS_EC_SENSOR_TEMP_WATER_BLOCK_OUT,
+	ec_sensor_temp_t_sensor_2 = ASUS_EC_SENSOR_TEMP_T_SENSOR_2,
+	ec_sensor_temp_sensor_extra_1 = ASUS_EC_SENSOR_TEMP_SENSOR_EXTRA_1,
+	ec_sensor_temp_sensor_extra_2 = ASUS_EC_SENSOR_TEMP_SENSOR_EXTRA_2,
+	ec_sensor_temp_sensor_extra_3 = ASUS_EC_SENSOR_TEMP_SENSOR_EXTRA_3,
+	ec_sensor_max = ASUS_EC_SENSOR_MAX,
 };
 
+/* Channels computed in the driver from pairs of EC sensors */
+enum ec_derived_sensors {
+	/* CPU power, CPU current times CPU core voltage [µW] */
+	ec_derived_power_cpu,
+	/* water temperature increase, Water_Out - Water_In [m℃] */
+	ec_derived_temp_water_delta,
+	/* CPU energy, CPU power integrated over time [µJ] */
+	ec_derived_energy_cpu,
+	/* number of derived sensors, keep last */
+	ec_derived_max,
+};
+
+#define ASUS_EC_MAX_SENSORS	ec_sensor_max
+/* sensor values span 4 registers at most */
+#define ASUS_EC_MAX_SENSOR_SIZE	4
+
 #define SENSOR_TEMP_CHIPSET BIT(ec_sensor_temp_chipset)
 #define SENSOR_TEMP_CPU BIT(ec_sensor_temp_cpu)
 #define SENSOR_TEMP_CPU_PACKAGE BIT(ec_sensor_temp_cpu_package)
@@ -165,122 +306,97 @@ enum ec_sensors {
 #define SENSOR_TEMP_SENSOR_EXTRA_2 BIT(ec_sensor_temp_sensor_extra_2)
 #define SENSOR_TEMP_SENSOR_EXTRA_3 BIT(ec_sensor_temp_sensor_extra_3)
 
-enum board_family {
-	family_unknown,
-	family_amd_400_series,
-	family_amd_500_series,
-	family_amd_600_series,
-	family_intel_300_series,
-	family_intel_600_series
-};
+/*
+ * All the known sensors for ASUS EC controllers, one list per board family
+ * of S(arg, id, label, type, size, bank, index) entries. The lists expand
+ * into the family tables below and into the board tables of
+ * DEFINE_EC_BOARD().
+ */
+#define EC_SENSORS_amd_400(S, arg)					\
+	S(arg, temp_chipset, "Chipset", hwmon_temp, 1, 0x00, 0x3a)	\
+	S(arg, temp_cpu, "CPU", hwmon_temp, 1, 0x00, 0x3b)		\
+	S(arg, temp_mb, "Motherboard", hwmon_temp, 1, 0x00, 0x3c)	\
+	S(arg, temp_t_sensor, "T_Sensor", hwmon_temp, 1, 0x00, 0x3d)	\
+	S(arg, temp_vrm, "VRM", hwmon_temp, 1, 0x00, 0x3e)		\
+	S(arg, in_cpu_core, "CPU Core", hwmon_in, 2, 0x00, 0xa2)	\
+	S(arg, fan_cpu_opt, "CPU_Opt", hwmon_fan, 2, 0x00, 0xbc)	\
+	S(arg, fan_vrm_hs, "VRM HS", hwmon_fan, 2, 0x00, 0xb2)		\
+	/* no chipset fans in this generation */			\
+	S(arg, fan_chipset, "Chipset", hwmon_fan, 0, 0x00, 0x00)	\
+	S(arg, fan_water_flow, "Water_Flow", hwmon_fan, 2, 0x00, 0xb4)	\
+	S(arg, curr_cpu, "CPU", hwmon_curr, 1, 0x00, 0xf4)		\
+	S(arg, temp_water_in, "Water_In", hwmon_temp, 1, 0x01, 0x0d)	\
+	S(arg, temp_water_out, "Water_Out", hwmon_temp, 1, 0x01, 0x0b)
+
+#define EC_SENSORS_amd_500(S, arg)							\
+	S(arg, temp_chipset, "Chipset", hwmon_temp, 1, 0x00, 0x3a)			\
+	S(arg, temp_cpu, "CPU", hwmon_temp, 1, 0x00, 0x3b)				\
+	S(arg, temp_mb, "Motherboard", hwmon_temp, 1, 0x00, 0x3c)			\
+	S(arg, temp_t_sensor, "T_Sensor", hwmon_temp, 1, 0x00, 0x3d)			\
+	S(arg, temp_vrm, "VRM", hwmon_temp, 1, 0x00, 0x3e)				\
+	S(arg, in_cpu_core, "CPU Core", hwmon_in, 2, 0x00, 0xa2)			\
+	S(arg, fan_cpu_opt, "CPU_Opt", hwmon_fan, 2, 0x00, 0xb0)			\
+	S(arg, fan_vrm_hs, "VRM HS", hwmon_fan, 2, 0x00, 0xb2)				\
+	S(arg, fan_chipset, "Chipset", hwmon_fan, 2, 0x00, 0xb4)			\
+	S(arg, fan_water_flow, "Water_Flow", hwmon_fan, 2, 0x00, 0xbc)			\
+	S(arg, curr_cpu, "CPU", hwmon_curr, 1, 0x00, 0xf4)				\
+	S(arg, temp_water_in, "Water_In", hwmon_temp, 1, 0x01, 0x00)			\
+	S(arg, temp_water_out, "Water_Out", hwmon_temp, 1, 0x01, 0x01)			\
+	S(arg, temp_water_block_in, "Water_Block_In", hwmon_temp, 1, 0x01, 0x02)	\
+	S(arg, temp_water_block_out, "Water_Block_Out", hwmon_temp, 1, 0x01, 0x03)	\
+	S(arg, temp_sensor_extra_1, "Extra_1", hwmon_temp, 1, 0x01, 0x09)		\
+	S(arg, temp_t_sensor_2, "T_sensor_2", hwmon_temp, 1, 0x01, 0x0a)		\
+	S(arg, temp_sensor_extra_2, "Extra_2", hwmon_temp, 1, 0x01, 0x0b)		\
+	S(arg, temp_sensor_extra_3, "Extra_3", hwmon_temp, 1, 0x01, 0x0c)
+
+#define EC_SENSORS_amd_600(S, arg)						\
+	S(arg, temp_cpu, "CPU", hwmon_temp, 1, 0x00, 0x30)			\
+	S(arg, temp_cpu_package, "CPU Package", hwmon_temp, 1, 0x00, 0x31)	\
+	S(arg, temp_mb, "Motherboard", hwmon_temp, 1, 0x00, 0x32)		\
+	S(arg, temp_vrm, "VRM", hwmon_temp, 1, 0x00, 0x33)			\
+	S(arg, temp_t_sensor, "T_Sensor", hwmon_temp, 1, 0x00, 0x36)		\
+	S(arg, temp_water_in, "Water_In", hwmon_temp, 1, 0x01, 0x00)		\
+	S(arg, temp_water_out, "Water_Out", hwmon_temp, 1, 0x01, 0x01)
+
+#define EC_SENSORS_intel_300(S, arg)					\
+	S(arg, temp_chipset, "Chipset", hwmon_temp, 1, 0x00, 0x3a)	\
+	S(arg, temp_cpu, "CPU", hwmon_temp, 1, 0x00, 0x3b)		\
+	S(arg, temp_mb, "Motherboard", hwmon_temp, 1, 0x00, 0x3c)	\
+	S(arg, temp_t_sensor, "T_Sensor", hwmon_temp, 1, 0x00, 0x3d)	\
+	S(arg, temp_vrm, "VRM", hwmon_temp, 1, 0x00, 0x3e)		\
+	S(arg, fan_cpu_opt, "CPU_Opt", hwmon_fan, 2, 0x00, 0xb0)	\
+	S(arg, fan_vrm_hs, "VRM HS", hwmon_fan, 2, 0x00, 0xb2)		\
+	S(arg, fan_water_flow, "Water_Flow", hwmon_fan, 2, 0x00, 0xbc)	\
+	S(arg, temp_water_in, "Water_In", hwmon_temp, 1, 0x01, 0x00)	\
+	S(arg, temp_water_out, "Water_Out", hwmon_temp, 1, 0x01, 0x01)
+
+#define EC_SENSORS_intel_600(S, arg)					\
+	S(arg, temp_t_sensor, "T_Sensor", hwmon_temp, 1, 0x00, 0x3d)	\
+	S(arg, temp_vrm, "VRM", hwmon_temp, 1, 0x00, 0x3e)
+
+#define EC_SENSOR_ENTRY(arg, id, sensor_label, sensor_type, size, bank,	\
+			index)							\
+	[ec_sensor_##id] = EC_SENSOR(sensor_label, sensor_type, size, bank,	\
+				     index),
 
-/* All the known sensors for ASUS EC controllers */
 static const struct ec_sensor_info sensors_family_amd_400[] = {
-	[ec_sensor_temp_chipset] =
-		EC_SENSOR("Chipset", hwmon_temp, 1, 0x00, 0x3a),
-	[ec_sensor_temp_cpu] =
-		EC_SENSOR("CPU", hwmon_temp, 1, 0x00, 0x3b),
-	[ec_sensor_temp_mb] =
-		EC_SENSOR("Motherboard", hwmon_temp, 1, 0x00, 0x3c),
-	[ec_sensor_temp_t_sensor] =
-		EC_SENSOR("T_Sensor", hwmon_temp, 1, 0x00, 0x3d),
-	[ec_sensor_temp_vrm] =
-		EC_SENSOR("VRM", hwmon_temp, 1, 0x00, 0x3e),
-	[ec_sensor_in_cpu_core] =
-		EC_SENSOR("CPU Core", hwmon_in, 2, 0x00, 0xa2),
-	[ec_sensor_fan_cpu_opt] =
-		EC_SENSOR("CPU_Opt", hwmon_fan, 2, 0x00, 0xbc),
-	[ec_sensor_fan_vrm_hs] =
-		EC_SENSOR("VRM HS", hwmon_fan, 2, 0x00, 0xb2),
-	[ec_sensor_fan_chipset] =
-		/* no chipset fans in this generation */
-		EC_SENSOR("Chipset", hwmon_fan, 0, 0x00, 0x00),
-	[ec_sensor_fan_water_flow] =
-		EC_SENSOR("Water_Flow", hwmon_fan, 2, 0x00, 0xb4),
-	[ec_sensor_curr_cpu] =
-		EC_SENSOR("CPU", hwmon_curr, 1, 0x00, 0xf4),
-	[ec_sensor_temp_water_in] =
-		EC_SENSOR("Water_In", hwmon_temp, 1, 0x01, 0x0d),
-	[ec_sensor_temp_water_out] =
-		EC_SENSOR("Water_Out", hwmon_temp, 1, 0x01, 0x0b),
+	EC_SENSORS_amd_400(EC_SENSOR_ENTRY, )
 };
 
 static const struct ec_sensor_info sensors_family_amd_500[] = {
-	[ec_sensor_temp_chipset] =
-		EC_SENSOR("Chipset", hwmon_temp, 1, 0x00, 0x3a),
-	[ec_sensor_temp_cpu] = EC_SENSOR("CPU", hwmon_temp, 1, 0x00, 0x3b),
-	[ec_sensor_temp_mb] =
-		EC_SENSOR("Motherboard", hwmon_temp, 1, 0x00, 0x3c),
-	[ec_sensor_temp_t_sensor] =
-		EC_SENSOR("T_Sensor", hwmon_temp, 1, 0x00, 0x3d),
-	[ec_sensor_temp_vrm] = EC_SENSOR("VRM", hwmon_temp, 1, 0x00, 0x3e),
-	[ec_sensor_in_cpu_core] =
-		EC_SENSOR("CPU Core", hwmon_in, 2, 0x00, 0xa2),
-	[ec_sensor_fan_cpu_opt] =
-		EC_SENSOR("CPU_Opt", hwmon_fan, 2, 0x00, 0xb0),
-	[ec_sensor_fan_vrm_hs] = EC_SENSOR("VRM HS", hwmon_fan, 2, 0x00, 0xb2),
-	[ec_sensor_fan_chipset] =
-		EC_SENSOR("Chipset", hwmon_fan, 2, 0x00, 0xb4),
-	[ec_sensor_fan_water_flow] =
-		EC_SENSOR("Water_Flow", hwmon_fan, 2, 0x00, 0xbc),
-	[ec_sensor_curr_cpu] = EC_SENSOR("CPU", hwmon_curr, 1, 0x00, 0xf4),
-	[ec_sensor_temp_water_in] =
-		EC_SENSOR("Water_In", hwmon_temp, 1, 0x01, 0x00),
-	[ec_sensor_temp_water_out] =
-		EC_SENSOR("Water_Out", hwmon_temp, 1, 0x01, 0x01),
-	[ec_sensor_temp_water_block_in] =
-		EC_SENSOR("Water_Block_In", hwmon_temp, 1, 0x01, 0x02),
-	[ec_sensor_temp_water_block_out] =
-		EC_SENSOR("Water_Block_Out", hwmon_temp, 1, 0x01, 0x03),
-	[ec_sensor_temp_sensor_extra_1] =
-		EC_SENSOR("Extra_1", hwmon_temp, 1, 0x01, 0x09),
-	[ec_sensor_temp_t_sensor_2] =
-		EC_SENSOR("T_sensor_2", hwmon_temp, 1, 0x01, 0x0a),
-	[ec_sensor_temp_sensor_extra_2] =
-		EC_SENSOR("Extra_2", hwmon_temp, 1, 0x01, 0x0b),
-	[ec_sensor_temp_sensor_extra_3] =
-		EC_SENSOR("Extra_3", hwmon_temp, 1, 0x01, 0x0c),
+	EC_SENSORS_amd_500(EC_SENSOR_ENTRY, )
 };
 
 static const struct ec_sensor_info sensors_family_amd_600[] = {
-	[ec_sensor_temp_cpu] = EC_SENSOR("CPU", hwmon_temp, 1, 0x00, 0x30),
-	[ec_sensor_temp_cpu_package] = EC_SENSOR("CPU Package", hwmon_temp, 1, 0x00, 0x31),
-	[ec_sensor_temp_mb] =
-	EC_SENSOR("Motherboard", hwmon_temp, 1, 0x00, 0x32),
-	[ec_sensor_temp_vrm] =
-		EC_SENSOR("VRM", hwmon_temp, 1, 0x00, 0x33),
-	[ec_sensor_temp_t_sensor] =
-		EC_SENSOR("T_Sensor", hwmon_temp, 1, 0x00, 0x36),
-	[ec_sensor_temp_water_in] =
-		EC_SENSOR("Water_In", hwmon_temp, 1, 0x01, 0x00),
-	[ec_sensor_temp_water_out] =
-		EC_SENSOR("Water_Out", hwmon_temp, 1, 0x01, 0x01),
+	EC_SENSORS_amd_600(EC_SENSOR_ENTRY, )
 };
 
 static const struct ec_sensor_info sensors_family_intel_300[] = {
-	[ec_sensor_temp_chipset] =
-		EC_SENSOR("Chipset", hwmon_temp, 1, 0x00, 0x3a),
-	[ec_sensor_temp_cpu] = EC_SENSOR("CPU", hwmon_temp, 1, 0x00, 0x3b),
-	[ec_sensor_temp_mb] =
-		EC_SENSOR("Motherboard", hwmon_temp, 1, 0x00, 0x3c),
-	[ec_sensor_temp_t_sensor] =
-		EC_SENSOR("T_Sensor", hwmon_temp, 1, 0x00, 0x3d),
-	[ec_sensor_temp_vrm] = EC_SENSOR("VRM", hwmon_temp, 1, 0x00, 0x3e),
-	[ec_sensor_fan_cpu_opt] =
-		EC_SENSOR("CPU_Opt", hwmon_fan, 2, 0x00, 0xb0),
-	[ec_sensor_fan_vrm_hs] = EC_SENSOR("VRM HS", hwmon_fan, 2, 0x00, 0xb2),
-	[ec_sensor_fan_water_flow] =
-		EC_SENSOR("Water_Flow", hwmon_fan, 2, 0x00, 0xbc),
-	[ec_sensor_temp_water_in] =
-		EC_SENSOR("Water_In", hwmon_temp, 1, 0x01, 0x00),
-	[ec_sensor_temp_water_out] =
-		EC_SENSOR("Water_Out", hwmon_temp, 1, 0x01, 0x01),
+	EC_SENSORS_intel_300(EC_SENSOR_ENTRY, )
 };
 
 static const struct ec_sensor_info sensors_family_intel_600[] = {
-	[ec_sensor_temp_t_sensor] =
-		EC_SENSOR("T_Sensor", hwmon_temp, 1, 0x00, 0x3d),
-	[ec_sensor_temp_vrm] = EC_SENSOR("VRM", hwmon_temp, 1, 0x00, 0x3e),
+	EC_SENSORS_intel_600(EC_SENSOR_ENTRY, )
 };
 
 /* Shortcuts for common combinations */
@@ -290,197 +406,298 @@ static const struct ec_sensor_info sensors_family_intel_600[] = {
 #define SENSOR_SET_WATER_BLOCK                                                 \
 	(SENSOR_TEMP_WATER_BLOCK_IN | SENSOR_TEMP_WATER_BLOCK_OUT)
 
-struct ec_board_info {
-	unsigned long sensors;
+struct ec_derived_info {
+	char label[SENSOR_LABEL_LEN];
+	enum hwmon_sensor_types type;
+	/* operands, from enum ec_sensors */
+	unsigned int operands[2];
+	/* computes the value in hwmon units from the operand values */
+	s64 (*compute)(s32 a, s32 b);
 	/*
-	 * Defines which mutex to use for guarding access to the state and the
-	 * hardware. Can be either a full path to an AML mutex or the
-	 * pseudo-path ACPI_GLOBAL_LOCK_PSEUDO_PATH to use the global ACPI lock,
-	 * or left empty to use a regular mutex object, in which case access to
-	 * the hardware is not guarded.
+	 * the computed value is a power [µW], which is integrated over time
+	 * into an energy counter [µJ]
 	 */
-	const char *mutex_path;
-	enum board_family family;
-};
-
-static const struct ec_board_info board_info_prime_x470_pro = {
-	.sensors = SENSOR_SET_TEMP_CHIPSET_CPU_MB |
-		SENSOR_TEMP_T_SENSOR | SENSOR_TEMP_VRM |
-		SENSOR_FAN_CPU_OPT |
-		SENSOR_CURR_CPU | SENSOR_IN_CPU_CORE,
-	.mutex_path = ACPI_GLOBAL_LOCK_PSEUDO_PATH,
-	.family = family_amd_400_series,
-};
-
-static const struct ec_board_info board_info_prime_x570_pro = {
-	.sensors = SENSOR_SET_TEMP_CHIPSET_CPU_MB | SENSOR_TEMP_VRM |
-		SENSOR_TEMP_T_SENSOR | SENSOR_FAN_CHIPSET,
-	.mutex_path = ASUS_HW_ACCESS_MUTEX_ASMX,
-	.family = family_amd_500_series,
-};
-
-static const struct ec_board_info board_info_pro_art_x570_creator_wifi = {
-	.sensors = SENSOR_SET_TEMP_CHIPSET_CPU_MB | SENSOR_TEMP_VRM |
-		SENSOR_TEMP_T_SENSOR | SENSOR_FAN_CPU_OPT |
-		SENSOR_CURR_CPU | SENSOR_IN_CPU_CORE,
-	.mutex_path = ASUS_HW_ACCESS_MUTEX_ASMX,
-	.family = family_amd_500_series,
-};
-
-static const struct ec_board_info board_info_pro_art_x670E_creator_wifi = {
-	.sensors = SENSOR_TEMP_CPU | SENSOR_TEMP_CPU_PACKAGE |
-		SENSOR_TEMP_MB | SENSOR_TEMP_VRM |
-		SENSOR_TEMP_T_SENSOR,
-	.mutex_path = ACPI_GLOBAL_LOCK_PSEUDO_PATH,
-	.family = family_amd_600_series,
-};
-
-static const struct ec_board_info board_info_pro_art_b550_creator = {
-	.sensors = SENSOR_SET_TEMP_CHIPSET_CPU_MB |
-		SENSOR_TEMP_T_SENSOR |
-		SENSOR_FAN_CPU_OPT,
-	.mutex_path = ASUS_HW_ACCESS_MUTEX_ASMX,
-	.family = family_amd_500_series,
-};
-
-static const struct ec_board_info board_info_pro_ws_x570_ace = {
-	.sensors = SENSOR_SET_TEMP_CHIPSET_CPU_MB | SENSOR_TEMP_VRM |
-		SENSOR_TEMP_T_SENSOR | SENSOR_FAN_CHIPSET |
-		SENSOR_CURR_CPU | SENSOR_IN_CPU_CORE,
-	.mutex_path = ASUS_HW_ACCESS_MUTEX_ASMX,
-	.family = family_amd_500_series,
-};
-
-static const struct ec_board_info board_info_crosshair_x670e_hero = {
-	.sensors = SENSOR_TEMP_CPU | SENSOR_TEMP_CPU_PACKAGE |
-		SENSOR_TEMP_MB | SENSOR_TEMP_VRM |
-		SENSOR_SET_TEMP_WATER,
-	.mutex_path = ACPI_GLOBAL_LOCK_PSEUDO_PATH,
-	.family = family_amd_600_series,
-};
-
-static const struct ec_board_info board_info_crosshair_x670e_gene = {
-	.sensors = SENSOR_TEMP_CPU | SENSOR_TEMP_CPU_PACKAGE |
-		SENSOR_TEMP_T_SENSOR |
-		SENSOR_TEMP_MB | SENSOR_TEMP_VRM,
-	.mutex_path = ACPI_GLOBAL_LOCK_PSEUDO_PATH,
-	.family = family_amd_600_series,
-};
-
-static const struct ec_board_info board_info_crosshair_viii_dark_hero = {
-	.sensors = SENSOR_SET_TEMP_CHIPSET_CPU_MB |
-		SENSOR_TEMP_T_SENSOR |
-		SENSOR_TEMP_VRM | SENSOR_SET_TEMP_WATER |
-		SENSOR_FAN_CPU_OPT | SENSOR_FAN_WATER_FLOW |
-		SENSOR_CURR_CPU | SENSOR_IN_CPU_CORE,
-	.mutex_path = ASUS_HW_ACCESS_MUTEX_ASMX,
-	.family = family_amd_500_series,
-};
-
-static const struct ec_board_info board_info_crosshair_viii_hero = {
-	.sensors = SENSOR_SET_TEMP_CHIPSET_CPU_MB |
-		SENSOR_TEMP_T_SENSOR |
-		SENSOR_TEMP_VRM | SENSOR_SET_TEMP_WATER |
-		SENSOR_FAN_CPU_OPT | SENSOR_FAN_CHIPSET |
-		SENSOR_FAN_WATER_FLOW | SENSOR_CURR_CPU |
-		SENSOR_IN_CPU_CORE,
-	.mutex_path = ASUS_HW_ACCESS_MUTEX_ASMX,
-	.family = family_amd_500_series,
-};
-
-static const struct ec_board_info board_info_maximus_xi_hero = {
-	.sensors = SENSOR_SET_TEMP_CHIPSET_CPU_MB |
-		SENSOR_TEMP_T_SENSOR |
-		SENSOR_TEMP_VRM | SENSOR_SET_TEMP_WATER |
-		SENSOR_FAN_CPU_OPT | SENSOR_FAN_WATER_FLOW,
-	.mutex_path = ASUS_HW_ACCESS_MUTEX_ASMX,
-	.family = family_intel_300_series,
-};
-
-static const struct ec_board_info board_info_crosshair_viii_impact = {
-	.sensors = SENSOR_SET_TEMP_CHIPSET_CPU_MB |
-		SENSOR_TEMP_T_SENSOR | SENSOR_TEMP_VRM |
-		SENSOR_FAN_CHIPSET | SENSOR_CURR_CPU |
-		SENSOR_IN_CPU_CORE,
-	.mutex_path = ASUS_HW_ACCESS_MUTEX_ASMX,
-	.family = family_amd_500_series,
-};
-
-static const struct ec_board_info board_info_strix_b550_e_gaming = {
-	.sensors = SENSOR_SET_TEMP_CHIPSET_CPU_MB |
-		SENSOR_TEMP_T_SENSOR | SENSOR_TEMP_VRM |
-		SENSOR_FAN_CPU_OPT,
-	.mutex_path = ASUS_HW_ACCESS_MUTEX_ASMX,
-	.family = family_amd_500_series,
+	bool integrate;
 };
 
-static const struct ec_board_info board_info_strix_b550_i_gaming = {
-	.sensors = SENSOR_SET_TEMP_CHIPSET_CPU_MB |
-		SENSOR_TEMP_T_SENSOR | SENSOR_TEMP_VRM |
-		SENSOR_FAN_VRM_HS | SENSOR_CURR_CPU |
-		SENSOR_IN_CPU_CORE,
-	.mutex_path = ASUS_HW_ACCESS_MUTEX_ASMX,
-	.family = family_amd_500_series,
-};
+/* [A] * [mV] -> [µW] */
+static s64 derive_power(s32 amps, s32 millivolts)
+{
+	return (s64)amps * millivolts * MILLI;
+}
 
-static const struct ec_board_info board_info_strix_x570_e_gaming = {
-	.sensors = SENSOR_SET_TEMP_CHIPSET_CPU_MB |
-		SENSOR_TEMP_T_SENSOR |
-		SENSOR_FAN_CHIPSET | SENSOR_CURR_CPU |
-		SENSOR_IN_CPU_CORE,
-	.mutex_path = ASUS_HW_ACCESS_MUTEX_ASMX,
-	.family = family_amd_500_series,
-};
+/* [℃] - [℃] -> [m℃] */
+static s64 derive_temp_delta(s32 in, s32 out)
+{
+	return (s64)(out - in) * MILLI;
+}
 
-static const struct ec_board_info board_info_strix_x570_e_gaming_wifi_ii = {
-	.sensors = SENSOR_SET_TEMP_CHIPSET_CPU_MB |
-		SENSOR_TEMP_T_SENSOR | SENSOR_CURR_CPU |
-		SENSOR_IN_CPU_CORE,
-	.mutex_path = ASUS_HW_ACCESS_MUTEX_ASMX,
-	.family = family_amd_500_series,
+static const struct ec_derived_info derived_sensors_info[] = {
+	[ec_derived_power_cpu] = {
+		.label = "CPU",
+		.type = hwmon_power,
+		.operands = { ec_sensor_curr_cpu, ec_sensor_in_cpu_core },
+		.compute = derive_power,
+	},
+	[ec_derived_temp_water_delta] = {
+		.label = "Water_Delta",
+		.type = hwmon_temp,
+		.operands = { ec_sensor_temp_water_in, ec_sensor_temp_water_out },
+		.compute = derive_temp_delta,
+	},
+	[ec_derived_energy_cpu] = {
+		.label = "CPU",
+		.type = hwmon_energy,
+		.operands = { ec_sensor_curr_cpu, ec_sensor_in_cpu_core },
+		.compute = derive_power,
+		.integrate = true,
+	},
 };
 
-static const struct ec_board_info board_info_strix_x570_f_gaming = {
-	.sensors = SENSOR_SET_TEMP_CHIPSET_CPU_MB |
-		SENSOR_TEMP_T_SENSOR | SENSOR_FAN_CHIPSET,
-	.mutex_path = ASUS_HW_ACCESS_MUTEX_ASMX,
-	.family = family_amd_500_series,
+struct ec_board_info {
+	unsigned long sensors;
+	/* the board sensors of each bank, read in this order */
+	unsigned long bank_sensors[ASUS_EC_MAX_BANK + 1];
+	/* the board sensors of each type, hwmon channels follow their order */
+	unsigned long type_sensors[hwmon_max];
+	/* number of EC registers of all the board sensors */
+	u8 nr_registers;
+	/* hwmon channels of the board, starting with the chip entry */
+	const struct hwmon_channel_info *const *hwmon_info;
+	/*
+	 * Defines which mutex to use for guarding access to the hardware.
+	 * Can be either a full path to an AML mutex, the pseudo-path
+	 * ACPI_GLOBAL_LOCK_PSEUDO_PATH to use the global ACPI lock, or the
+	 * pseudo-path LOCAL_LOCK_PSEUDO_PATH to use a regular mutex object,
+	 * in which case access to the hardware is not guarded against the
+	 * firmware.
+	 */
+	const char *mutex_path;
+	const struct ec_sensor_info *sensors_info;
 };
 
-static const struct ec_board_info board_info_strix_x570_i_gaming = {
-	.sensors = SENSOR_TEMP_CHIPSET | SENSOR_TEMP_VRM |
-		SENSOR_TEMP_T_SENSOR |
-		SENSOR_FAN_VRM_HS | SENSOR_FAN_CHIPSET |
-		SENSOR_CURR_CPU | SENSOR_IN_CPU_CORE,
-	.mutex_path = ASUS_HW_ACCESS_MUTEX_ASMX,
-	.family = family_amd_500_series,
-};
+/* Filters of the family sensor lists for DEFINE_EC_BOARD() */
+#define EC_SENSOR_IF_BANK(arg, id, label, type, size, bank, index)	\
+	| ((bank) == (arg) ? BIT(ec_sensor_##id) : 0)
+#define EC_SENSOR_IF_TYPE(arg, id, label, type, size, bank, index)	\
+	| ((type) == (arg) ? BIT(ec_sensor_##id) : 0)
+#define EC_SENSOR_SIZE_IF_SET(arg, id, label, type, size, bank, index)	\
+	+ ((arg) & BIT(ec_sensor_##id) ? (size) : 0)
+
+#define EC_BANK_SENSORS(family, sensor_set, bank)				\
+	((sensor_set) & (0UL EC_SENSORS_##family(EC_SENSOR_IF_BANK, bank)))
+#define EC_TYPE_SENSORS(family, sensor_set, type)				\
+	((sensor_set) & (0UL EC_SENSORS_##family(EC_SENSOR_IF_TYPE, type)))
+
+/* for the HWEIGHT32() of the sensor sets */
+static_assert(ASUS_EC_MAX_SENSORS <= 32);
+
+/* Slots for all the hwmon channels of a type: EC sensors, then derived ones */
+#define EC_CHANNEL_SLOTS(S, ...)						\
+	S(0, __VA_ARGS__) S(1, __VA_ARGS__) S(2, __VA_ARGS__)			\
+	S(3, __VA_ARGS__) S(4, __VA_ARGS__) S(5, __VA_ARGS__)			\
+	S(6, __VA_ARGS__) S(7, __VA_ARGS__) S(8, __VA_ARGS__)			\
+	S(9, __VA_ARGS__) S(10, __VA_ARGS__) S(11, __VA_ARGS__)			\
+	S(12, __VA_ARGS__) S(13, __VA_ARGS__) S(14, __VA_ARGS__)		\
+	S(15, __VA_ARGS__) S(16, __VA_ARGS__) S(17, __VA_ARGS__)		\
+	S(18, __VA_ARGS__) S(19, __VA_ARGS__) S(20, __VA_ARGS__)		\
+	S(21, __VA_ARGS__) S(22, __VA_ARGS__)
+#define EC_NR_CHANNEL_SLOTS	23
+
+static_assert(EC_NR_CHANNEL_SLOTS >= ASUS_EC_MAX_SENSORS + ec_derived_max);
+
+#define EC_CHANNEL_CONFIG(i, nr, config, derived_config)			\
+	(i) < (nr) ? (config) :							\
+	(i) < (nr) + ec_derived_max ? (derived_config) : 0,
 
-static const struct ec_board_info board_info_strix_z390_f_gaming = {
-	.sensors = SENSOR_TEMP_CHIPSET | SENSOR_TEMP_VRM |
-		SENSOR_TEMP_T_SENSOR |
-		SENSOR_FAN_CPU_OPT,
-	.mutex_path = ASUS_HW_ACCESS_MUTEX_ASMX,
-	.family = family_intel_300_series,
-};
+/*
+ * Channels of a type: the board sensors of the type, followed by one
+ * channel per derived sensor, which stays hidden unless a derived sensor
+ * of the type is available, see find_derived_index()
+ */
+#define EC_HWMON_CHANNEL_INFO(stype, nr)					\
+	(&(const struct hwmon_channel_info) {					\
+		.type = hwmon_##stype,						\
+		.config = (const u32 []) {					\
+			EC_CHANNEL_SLOTS(EC_CHANNEL_CONFIG, nr,			\
+					 EC_HWMON_CONFIG_##stype,		\
+					 EC_HWMON_DERIVED_CONFIG_##stype)	\
+			0							\
+		},								\
+	})
 
-static const struct ec_board_info board_info_strix_z690_a_gaming_wifi_d4 = {
-	.sensors = SENSOR_TEMP_T_SENSOR | SENSOR_TEMP_VRM,
-	.mutex_path = ASUS_HW_ACCESS_MUTEX_RMTW_ASMX,
-	.family = family_intel_600_series,
-};
+/*
+ * Defines board_info_<name> with the tables of the board computed at
+ * compile time from the sensor list of its family. Probing only has to
+ * filter out the absent and disabled sensors from the read plan.
+ */
+#define DEFINE_EC_BOARD(name, family, lock_path, sensor_set)			\
+	enum {									\
+		board_##name##_temp = HWEIGHT32(EC_TYPE_SENSORS(family,	\
+					sensor_set, hwmon_temp)),		\
+		board_##name##_in = HWEIGHT32(EC_TYPE_SENSORS(family,		\
+					sensor_set, hwmon_in)),			\
+		board_##name##_curr = HWEIGHT32(EC_TYPE_SENSORS(family,	\
+					sensor_set, hwmon_curr)),		\
+		board_##name##_fan = HWEIGHT32(EC_TYPE_SENSORS(family,		\
+					sensor_set, hwmon_fan)),		\
+	};									\
+										\
+	static const struct hwmon_channel_info *const				\
+	board_hwmon_info_##name[] = {						\
+		HWMON_CHANNEL_INFO(chip, HWMON_C_REGISTER_TZ),			\
+		EC_HWMON_CHANNEL_INFO(temp, board_##name##_temp),		\
+		EC_HWMON_CHANNEL_INFO(in, board_##name##_in),			\
+		EC_HWMON_CHANNEL_INFO(curr, board_##name##_curr),		\
+		EC_HWMON_CHANNEL_INFO(fan, board_##name##_fan),			\
+		EC_HWMON_CHANNEL_INFO(power, 0),				\
+		EC_HWMON_CHANNEL_INFO(energy, 0),				\
+		NULL								\
+	};									\
+										\
+	static const struct ec_board_info board_info_##name = {			\
+		.sensors = (sensor_set),					\
+		.bank_sensors = {						\
+			EC_BANK_SENSORS(family, sensor_set, 0),			\
+			EC_BANK_SENSORS(family, sensor_set, 1),			\
+			EC_BANK_SENSORS(family, sensor_set, 2),			\
+			EC_BANK_SENSORS(family, sensor_set, 3),			\
+		},								\
+		.type_sensors = {						\
+			[hwmon_temp] = EC_TYPE_SENSORS(family, sensor_set,	\
+						       hwmon_temp),		\
+			[hwmon_in] = EC_TYPE_SENSORS(family, sensor_set,	\
+						     hwmon_in),			\
+			[hwmon_curr] = EC_TYPE_SENSORS(family, sensor_set,	\
+						       hwmon_curr),		\
+			[hwmon_fan] = EC_TYPE_SENSORS(family, sensor_set,	\
+						      hwmon_fan),		\
+		},								\
+		.nr_registers = 0 EC_SENSORS_##family(EC_SENSOR_SIZE_IF_SET,	\
+						      sensor_set),		\
+		.hwmon_info = board_hwmon_info_##name,				\
+		.mutex_path = lock_path,					\
+		.sensors_info = sensors_family_##family,			\
+	}
 
-static const struct ec_board_info board_info_zenith_ii_extreme = {
-	.sensors = SENSOR_SET_TEMP_CHIPSET_CPU_MB | SENSOR_TEMP_T_SENSOR |
-		SENSOR_TEMP_VRM | SENSOR_SET_TEMP_WATER |
-		SENSOR_FAN_CPU_OPT | SENSOR_FAN_CHIPSET | SENSOR_FAN_VRM_HS |
-		SENSOR_FAN_WATER_FLOW | SENSOR_CURR_CPU | SENSOR_IN_CPU_CORE |
-		SENSOR_SET_WATER_BLOCK |
-		SENSOR_TEMP_T_SENSOR_2 | SENSOR_TEMP_SENSOR_EXTRA_1 |
-		SENSOR_TEMP_SENSOR_EXTRA_2 | SENSOR_TEMP_SENSOR_EXTRA_3,
-	.mutex_path = ASUS_HW_ACCESS_MUTEX_SB_PCI0_SBRG_SIO1_MUT0,
-	.family = family_amd_500_series,
-};
+/* bank_sensors[] above lists the banks one by one */
+static_assert(ASUS_EC_MAX_BANK == 3);
+
+DEFINE_EC_BOARD(prime_x470_pro, amd_400, ACPI_GLOBAL_LOCK_PSEUDO_PATH,
+	SENSOR_SET_TEMP_CHIPSET_CPU_MB |
+	SENSOR_TEMP_T_SENSOR | SENSOR_TEMP_VRM |
+	SENSOR_FAN_CPU_OPT |
+	SENSOR_CURR_CPU | SENSOR_IN_CPU_CORE);
+
+DEFINE_EC_BOARD(prime_x570_pro, amd_500, ASUS_HW_ACCESS_MUTEX_ASMX,
+	SENSOR_SET_TEMP_CHIPSET_CPU_MB | SENSOR_TEMP_VRM |
+	SENSOR_TEMP_T_SENSOR | SENSOR_FAN_CHIPSET);
+
+DEFINE_EC_BOARD(pro_art_x570_creator_wifi, amd_500, ASUS_HW_ACCESS_MUTEX_ASMX,
+	SENSOR_SET_TEMP_CHIPSET_CPU_MB | SENSOR_TEMP_VRM |
+	SENSOR_TEMP_T_SENSOR | SENSOR_FAN_CPU_OPT |
+	SENSOR_CURR_CPU | SENSOR_IN_CPU_CORE);
+
+DEFINE_EC_BOARD(pro_art_x670E_creator_wifi, amd_600, ACPI_GLOBAL_LOCK_PSEUDO_PATH,
+	SENSOR_TEMP_CPU | SENSOR_TEMP_CPU_PACKAGE |
+	SENSOR_TEMP_MB | SENSOR_TEMP_VRM |
+	SENSOR_TEMP_T_SENSOR);
+
+DEFINE_EC_BOARD(pro_art_b550_creator, amd_500, ASUS_HW_ACCESS_MUTEX_ASMX,
+	SENSOR_SET_TEMP_CHIPSET_CPU_MB |
+	SENSOR_TEMP_T_SENSOR |
+	SENSOR_FAN_CPU_OPT);
+
+DEFINE_EC_BOARD(pro_ws_x570_ace, amd_500, ASUS_HW_ACCESS_MUTEX_ASMX,
+	SENSOR_SET_TEMP_CHIPSET_CPU_MB | SENSOR_TEMP_VRM |
+	SENSOR_TEMP_T_SENSOR | SENSOR_FAN_CHIPSET |
+	SENSOR_CURR_CPU | SENSOR_IN_CPU_CORE);
+
+DEFINE_EC_BOARD(crosshair_x670e_hero, amd_600, ACPI_GLOBAL_LOCK_PSEUDO_PATH,
+	SENSOR_TEMP_CPU | SENSOR_TEMP_CPU_PACKAGE |
+	SENSOR_TEMP_MB | SENSOR_TEMP_VRM |
+	SENSOR_SET_TEMP_WATER);
+
+DEFINE_EC_BOARD(crosshair_x670e_gene, amd_600, ACPI_GLOBAL_LOCK_PSEUDO_PATH,
+	SENSOR_TEMP_CPU | SENSOR_TEMP_CPU_PACKAGE |
+	SENSOR_TEMP_T_SENSOR |
+	SENSOR_TEMP_MB | SENSOR_TEMP_VRM);
+
+DEFINE_EC_BOARD(crosshair_viii_dark_hero, amd_500, ASUS_HW_ACCESS_MUTEX_ASMX,
+	SENSOR_SET_TEMP_CHIPSET_CPU_MB |
+	SENSOR_TEMP_T_SENSOR |
+	SENSOR_TEMP_VRM | SENSOR_SET_TEMP_WATER |
+	SENSOR_FAN_CPU_OPT | SENSOR_FAN_WATER_FLOW |
+	SENSOR_CURR_CPU | SENSOR_IN_CPU_CORE);
+
+DEFINE_EC_BOARD(crosshair_viii_hero, amd_500, ASUS_HW_ACCESS_MUTEX_ASMX,
+	SENSOR_SET_TEMP_CHIPSET_CPU_MB |
+	SENSOR_TEMP_T_SENSOR |
+	SENSOR_TEMP_VRM | SENSOR_SET_TEMP_WATER |
+	SENSOR_FAN_CPU_OPT | SENSOR_FAN_CHIPSET |
+	SENSOR_FAN_WATER_FLOW | SENSOR_CURR_CPU |
+	SENSOR_IN_CPU_CORE);
+
+DEFINE_EC_BOARD(maximus_xi_hero, intel_300, ASUS_HW_ACCESS_MUTEX_ASMX,
+	SENSOR_SET_TEMP_CHIPSET_CPU_MB |
+	SENSOR_TEMP_T_SENSOR |
+	SENSOR_TEMP_VRM | SENSOR_SET_TEMP_WATER |
+	SENSOR_FAN_CPU_OPT | SENSOR_FAN_WATER_FLOW);
+
+DEFINE_EC_BOARD(crosshair_viii_impact, amd_500, ASUS_HW_ACCESS_MUTEX_ASMX,
+	SENSOR_SET_TEMP_CHIPSET_CPU_MB |
+	SENSOR_TEMP_T_SENSOR | SENSOR_TEMP_VRM |
+	SENSOR_FAN_CHIPSET | SENSOR_CURR_CPU |
+	SENSOR_IN_CPU_CORE);
+
+DEFINE_EC_BOARD(strix_b550_e_gaming, amd_500, ASUS_HW_ACCESS_MUTEX_ASMX,
+	SENSOR_SET_TEMP_CHIPSET_CPU_MB |
+	SENSOR_TEMP_T_SENSOR | SENSOR_TEMP_VRM |
+	SENSOR_FAN_CPU_OPT);
+
+DEFINE_EC_BOARD(strix_b550_i_gaming, amd_500, ASUS_HW_ACCESS_MUTEX_ASMX,
+	SENSOR_SET_TEMP_CHIPSET_CPU_MB |
+	SENSOR_TEMP_T_SENSOR | SENSOR_TEMP_VRM |
+	SENSOR_FAN_VRM_HS | SENSOR_CURR_CPU |
+	SENSOR_IN_CPU_CORE);
+
+DEFINE_EC_BOARD(strix_x570_e_gaming, amd_500, ASUS_HW_ACCESS_MUTEX_ASMX,
+	SENSOR_SET_TEMP_CHIPSET_CPU_MB |
+	SENSOR_TEMP_T_SENSOR |
+	SENSOR_FAN_CHIPSET | SENSOR_CURR_CPU |
+	SENSOR_IN_CPU_CORE);
+
+DEFINE_EC_BOARD(strix_x570_e_gaming_wifi_ii, amd_500, ASUS_HW_ACCESS_MUTEX_ASMX,
+	SENSOR_SET_TEMP_CHIPSET_CPU_MB |
+	SENSOR_TEMP_T_SENSOR | SENSOR_CURR_CPU |
+	SENSOR_IN_CPU_CORE);
+
+DEFINE_EC_BOARD(strix_x570_f_gaming, amd_500, ASUS_HW_ACCESS_MUTEX_ASMX,
+	SENSOR_SET_TEMP_CHIPSET_CPU_MB |
+	SENSOR_TEMP_T_SENSOR | SENSOR_FAN_CHIPSET);
+
+DEFINE_EC_BOARD(strix_x570_i_gaming, amd_500, ASUS_HW_ACCESS_MUTEX_ASMX,
+	SENSOR_TEMP_CHIPSET | SENSOR_TEMP_VRM |
+	SENSOR_TEMP_T_SENSOR |
+	SENSOR_FAN_VRM_HS | SENSOR_FAN_CHIPSET |
+	SENSOR_CURR_CPU | SENSOR_IN_CPU_CORE);
+
+DEFINE_EC_BOARD(strix_z390_f_gaming, intel_300, ASUS_HW_ACCESS_MUTEX_ASMX,
+	SENSOR_TEMP_CHIPSET | SENSOR_TEMP_VRM |
+	SENSOR_TEMP_T_SENSOR |
+	SENSOR_FAN_CPU_OPT);
+
+DEFINE_EC_BOARD(strix_z690_a_gaming_wifi_d4, intel_600, ASUS_HW_ACCESS_MUTEX_RMTW_ASMX,
+	SENSOR_TEMP_T_SENSOR | SENSOR_TEMP_VRM);
+
+DEFINE_EC_BOARD(zenith_ii_extreme, amd_500, ASUS_HW_ACCESS_MUTEX_SB_PCI0_SBRG_SIO1_MUT0,
+	SENSOR_SET_TEMP_CHIPSET_CPU_MB | SENSOR_TEMP_T_SENSOR |
+	SENSOR_TEMP_VRM | SENSOR_SET_TEMP_WATER |
+	SENSOR_FAN_CPU_OPT | SENSOR_FAN_CHIPSET | SENSOR_FAN_VRM_HS |
+	SENSOR_FAN_WATER_FLOW | SENSOR_CURR_CPU | SENSOR_IN_CPU_CORE |
+	SENSOR_SET_WATER_BLOCK |
+	SENSOR_TEMP_T_SENSOR_2 | SENSOR_TEMP_SENSOR_EXTRA_1 |
+	SENSOR_TEMP_SENSOR_EXTRA_2 | SENSOR_TEMP_SENSOR_EXTRA_3);
 
 #define DMI_EXACT_MATCH_ASUS_BOARD_NAME(name, board_info)                      \
 	{                                                                      \
@@ -549,6 +766,201 @@ static const struct dmi_system_id dmi_table[] = {
 struct ec_sensor {
 	unsigned int info_index;
 	s32 cached_value;
+	/* value read during the current update, not published yet */
+	s32 read_value;
+	/* read_value was read successfully */
+	bool read_ok;
+	/* cached_value holds a value read from the EC */
+	bool valid;
+	/* when cached_value was read */
+	ktime_t updated;
+	/* failed reads in total and failed refreshes since the last good one */
+	u32 errors;
+	u32 failures;
+	int last_error;
+	/* false if the sensor header looks unconnected, see the README */
+	bool present;
+	/* false if the user is not interested in the sensor */
+	bool enabled;
+	/* moving average, fixed point with average_shift fractional bits */
+	bool average_valid;
+	s64 average;
+};
+
+/* Part of the read plan that lies in a single register bank */
+struct ec_bank_segment {
+	u8 bank;
+	/* range of read_plan entries [first, end) */
+	u8 first;
+	u8 end;
+	u8 nr_registers;
+	/* monotonic time the last read of the segment finished at */
+	ktime_t read_time;
+};
+
+struct ec_derived {
+	/* operand indices into ec_sensors_data.sensors */
+	u8 operands[2];
+	/* the board has both the operands */
+	bool available;
+	/* both the operands were read in the last update */
+	bool valid;
+	/*
+	 * 64 bits because the energy counter [µJ] overflows a 32-bit long in
+	 * minutes; hwmon attributes are long and wrap around there
+	 */
+	s64 value;
+	/* integrated derived sensors: the energy counter [nJ] */
+	u64 energy;
+	/* power and time of the previous sample, to integrate from */
+	s64 last_power;
+	ktime_t last_time;
+};
+
+/* Values of a sensor over a period that is being rolled up */
+struct ec_history_accum {
+	/* period number since boot, the period length depends on the tier */
+	u32 period;
+	u32 count;
+	s32 min;
+	s32 max;
+	s64 sum;
+};
+
+struct ec_history_summary {
+	/* period start, in seconds since boot */
+	u32 start;
+	s32 min;
+	s32 avg;
+	s32 max;
+};
+
+/*
+ * History of a single sensor: the latest raw samples and min/avg/max of the
+ * values over the latest minutes and hours.
+ */
+struct ec_history {
+	/*
+	 * ring of raw samples, each encoded as time [ms] and value deltas from
+	 * the previous sample, see asus_ec_history_add_raw()
+	 */
+	u8 *raw;
+	unsigned int raw_tail;
+	unsigned int raw_used;
+	unsigned int nr_raw;
+	/* number of the oldest sample in the ring, counting from the first */
+	u64 first_raw;
+	/* sample just before the oldest one in the ring */
+	s64 base_time;
+	s32 base_value;
+	/* the latest sample */
+	s64 last_time;
+	s32 last_value;
+	bool started;
+	struct ec_history_accum minute;
+	struct ec_history_accum hour;
+	/* rings, indexed with the number of summaries ever added */
+	struct ec_history_summary minutes[ASUS_EC_HISTORY_MINUTES];
+	struct ec_history_summary hours[ASUS_EC_HISTORY_HOURS];
+	u32 nr_minutes;
+	u32 nr_hours;
+};
+
+/*
+ * A block read by another driver, see asus_ec_read_block_batched().
+ * Shared by the caller and the driver, because the caller may stop waiting
+ * before the request is served.
+ */
+struct ec_block_request {
+	struct list_head node;
+	struct kref ref;
+	u8 bank;
+	u8 start;
+	u8 len;
+	int status;
+	struct completion done;
+	u8 buf[ASUS_EC_BANK_SIZE];
+};
+
+/* Thermal zone of a temperature sensor */
+struct ec_thermal_zone {
+	struct ec_sensors_data *ec;
+	struct thermal_zone_device *tzd;
+	/* index into ec_sensors_data.sensors */
+	unsigned int sensor;
+	/* temperature in the previous snapshot [m℃] */
+	int last_temp;
+	bool reported;
+	/* a trip point was crossed, the thermal core is to be notified */
+	bool notify;
+};
+
+/* Burst capture of a subset of sensors, driven via debugfs */
+struct ec_capture {
+	/* guards the fields below against re-arming while being read */
+	struct mutex lock;
+	struct work_struct work;
+	/* completed when no capture is running */
+	struct completion done;
+	/* indices of the sensors to capture, grouped by bank */
+	u8 sensors[ASUS_EC_MAX_SENSORS];
+	u8 nr_sensors;
+	unsigned int nr_samples;
+	unsigned int nr_captured;
+	unsigned int period_us;
+	/* nr_samples timestamps and nr_samples * nr_sensors values */
+	s64 *timestamps;
+	s32 *values;
+	int status;
+	bool running;
+	bool abort;
+};
+
+struct ec_stats {
+	/* successful and failed sensor updates */
+	u64 updates;
+	u64 update_errors;
+	/* fixed-rate sampler: samples taken and periods skipped */
+	u64 sampler_samples;
+	u64 sampler_missed;
+	/* delay between the sampling deadline and the actual read */
+	s64 jitter_min_ns;
+	s64 jitter_max_ns;
+	s64 jitter_sum_ns;
+	/* EC transactions charged to the budget and refreshes deferred */
+	u64 budget_used;
+	u64 budget_deferrals;
+	/*
+	 * guarded by hw_mutex: the EC was found on a non-zero bank, i.e. the
+	 * firmware was accessing it, and slow hardware lock acquisitions
+	 */
+	u64 collisions;
+	u64 slow_lock_waits;
+	s64 lock_wait_max_ns;
+	/* failed sensor reads, segment re-reads and updates that lost sensors */
+	u64 read_errors;
+	u64 read_retries;
+	u64 partial_updates;
+	/*
+	 * updates stopped by refresh_budget_us or the transaction budget
+	 * before reading all the banks
+	 */
+	u64 truncated_updates;
+};
+
+/* Collisions by sampling phase, see asus_ec_adapt_phase() */
+struct ec_phase {
+	unsigned int slot;
+	u32 slot_samples[ASUS_EC_PHASE_SLOTS];
+	u32 slot_collisions[ASUS_EC_PHASE_SLOTS];
+	u32 window_samples;
+	u32 window_collisions;
+	u64 shifts;
+	/* samples and collisions at the initial phase and since the last shift */
+	u64 initial_samples;
+	u64 initial_collisions;
+	u64 current_samples;
+	u64 current_collisions;
 };
 
 struct lock_data {
@@ -556,6 +968,8 @@ struct lock_data {
 		acpi_handle aml;
 		/* global lock handle */
 		u32 glk;
+		/* driver-local lock, shared by all instances */
+		struct mutex *local;
 	} mutex;
 	bool (*lock)(struct lock_data *data);
 	bool (*unlock)(struct lock_data *data);
@@ -591,20 +1005,113 @@ static bool unlock_global_acpi_lock(struct lock_data *data)
 	return ACPI_SUCCESS(acpi_release_global_lock(data->mutex.glk));
 }
 
+/*
+ * The EC bank register is a single resource, hence the driver-local lock
+ * has to be shared by all the driver instances
+ */
+static DEFINE_MUTEX(asus_ec_local_lock);
+
+static bool lock_via_local_mutex(struct lock_data *data)
+{
+	mutex_lock(data->mutex.local);
+	return true;
+}
+
+static bool unlock_local_mutex(struct lock_data *data)
+{
+	mutex_unlock(data->mutex.local);
+	return true;
+}
+
+/*
+ * The per-board tables are static, see DEFINE_EC_BOARD(), the rest of the
+ * per-board data is sized for the largest possible board at compile time,
+ * so that probing does not need any allocations besides this structure
+ * itself.
+ */
 struct ec_sensors_data {
+	struct device *dev;
 	const struct ec_board_info *board_info;
 	const struct ec_sensor_info *sensors_info;
-	struct ec_sensor *sensors;
-	/* EC registers to read from */
-	u16 *registers;
-	u8 *read_buffer;
-	/* sorted list of unique register banks */
-	u8 banks[ASUS_EC_MAX_BANK + 1];
+	struct ec_sensor sensors[ASUS_EC_MAX_SENSORS];
+	/* indices of the sensors to read, grouped by bank */
+	u8 read_plan[ASUS_EC_MAX_SENSORS];
+	struct ec_bank_segment segments[ASUS_EC_MAX_BANK + 1];
+	/* segment to resume the next update from, see refresh_budget_us */
+	u8 next_segment;
 	/* in jiffies */
 	unsigned long last_updated;
+	/* monotonic time of the last successful update */
+	ktime_t last_sample_time;
+	/*
+	 * the latest snapshot as a latch: the copy being written is never
+	 * the one readers are directed to
+	 */
+	seqcount_latch_t snapshot_seq;
+	struct asus_ec_snapshot snapshots[2];
+	/* snapshots go to other drivers and netlink, see asus_ec_instance */
+	bool exported;
+	/*
+	 * Guards the driver state. The hardware lock below may be released
+	 * in the middle of an update (see release_lock_per_bank), hence
+	 * it can't serve this purpose alone.
+	 */
+	struct mutex update_lock;
 	struct lock_data lock_data;
+	/* banked EC registers, see asus_ec_regmap_lock() */
+	struct regmap *regmap;
+	/* serialises driver threads before they take the hardware lock */
+	struct mutex hw_mutex;
+	struct task_struct *hw_lock_owner;
+	unsigned int hw_lock_depth;
+	/* whether the hardware lock was successfully acquired */
+	bool hw_locked;
+	/* bank the EC was switched to when we acquired the lock */
+	unsigned int saved_bank;
+	/*
+	 * token bucket limiting EC transactions of refreshes, in units of
+	 * 1/NSEC_PER_SEC transaction, see ec_transactions_per_sec
+	 */
+	u64 budget_tokens;
+	ktime_t budget_updated;
+	/* block reads to perform with the next refresh, guarded by update_lock */
+	struct list_head block_requests;
+	/* callers of the exported functions, see asus_ec_pin_instance() */
+	atomic_t users;
+	/* the task running the snapshot notifiers */
+	struct task_struct *notifying;
+	/* re-checks sensors found absent for being plugged in */
+	struct delayed_work presence_work;
+	struct dentry *debugfs;
+	struct ec_capture capture;
+	/* fixed-rate sampling, see sample_period_ms */
+	struct hrtimer sample_timer;
+	struct work_struct sample_work;
+	ktime_t sample_period;
+	ktime_t sample_deadline;
+	/* start of the current period, deadlines are offset from it */
+	ktime_t sample_base;
+	s64 sample_offset_ns;
+	u32 sample_jitter_ns;
+	struct ec_phase phase;
+	/* guarded by update_lock, except for sampler_missed */
+	struct ec_stats stats;
+	struct ec_derived derived[ec_derived_max];
+	/* per sensor, NULL if history_bytes is 0 */
+	struct ec_history *history;
+	/* per sensor value counts, NULL if histograms are disabled */
+	u32 (*histograms)[ASUS_EC_HISTOGRAM_BUCKETS];
+	/* one per temperature channel, see asus_ec_thermal_register() */
+	struct ec_thermal_zone *thermal_zones;
+	unsigned int nr_thermal_zones;
+	struct thermal_trip thermal_trips[ASUS_EC_MAX_THERMAL_TRIPS];
+	/* notifies the thermal core outside of the update lock */
+	struct work_struct thermal_work;
+	struct hwmon_chip_info chip_info;
 	/* number of board EC sensors */
 	u8 nr_sensors;
+	/* number of sensors in the read plan */
+	u8 nr_planned;
 	/*
 	 * number of EC registers to read
 	 * (sensor might span more than 1 register)
@@ -614,14 +1121,12 @@ struct ec_sensors_data {
 	u8 nr_banks;
 };
 
-static u8 register_bank(u16 reg)
-{
-	return reg >> 8;
-}
-
-static u8 register_index(u16 reg)
+/* regmap address of the first register of the sensor value */
+static unsigned int sensor_register(const struct ec_sensor_info *si)
 {
-	return reg & 0x00ff;
+	return ASUS_EC_REGMAP_BANKED_BASE +
+		si->addr.components.bank * ASUS_EC_BANK_SIZE +
+		si->addr.components.index;
 }
 
 static bool is_sensor_data_signed(const struct ec_sensor_info *si)
@@ -639,325 +1144,3432 @@ get_sensor_info(const struct ec_sensors_data *state, int index)
 	return state->sensors_info + state->sensors[index].info_index;
 }
 
+/* index into sensors[] of the board sensor with the given id */
+static unsigned int sensor_index(const struct ec_sensors_data *ec,
+				 unsigned int id)
+{
+	return hweight_long(ec->board_info->sensors & (BIT(id) - 1));
+}
+
+static unsigned int nr_channels(const struct ec_sensors_data *ec,
+				enum hwmon_sensor_types type)
+{
+	return hweight_long(ec->board_info->type_sensors[type]);
+}
+
 static int find_ec_sensor_index(const struct ec_sensors_data *ec,
 				enum hwmon_sensor_types type, int channel)
+{
+	if (type >= hwmon_max || channel < 0 ||
+	    channel >= nr_channels(ec, type))
+		return -ENOENT;
+	return sensor_index(ec,
+			    find_nth_bit(&ec->board_info->type_sensors[type],
+					 ASUS_EC_MAX_SENSORS, channel));
+}
+
+/* Derived channels follow the sensor ones, one per derived sensor of the type */
+static int find_derived_index(const struct ec_sensors_data *ec,
+			      enum hwmon_sensor_types type, int channel)
 {
 	unsigned int i;
 
-	for (i = 0; i < ec->nr_sensors; i++) {
-		if (get_sensor_info(ec, i)->type == type) {
-			if (channel == 0)
-				return i;
-			channel--;
-		}
+	if (type >= hwmon_max || channel < nr_channels(ec, type))
+		return -ENOENT;
+	channel -= nr_channels(ec, type);
+	for (i = 0; i < ec_derived_max; i++) {
+		if (derived_sensors_info[i].type != type)
+			continue;
+		if (!channel--)
+			return ec->derived[i].available ? i : -ENOENT;
 	}
 	return -ENOENT;
 }
 
-static int bank_compare(const void *a, const void *b)
+static bool is_sensor_active(const struct ec_sensor *s)
+{
+	return s->present && s->enabled;
+}
+
+/* The sensor is active and has a value to report */
+static bool is_sensor_valid(const struct ec_sensor *s)
+{
+	return is_sensor_active(s) && s->valid;
+}
+
+static bool is_sensor_blank(const struct ec_sensor_info *si, s32 value)
 {
-	return *((const s8 *)a) - *((const s8 *)b);
+	return si->type == hwmon_temp && si->addr.components.size == 1 &&
+		(u8)value == ASUS_EC_SENSOR_BLANK_VALUE;
 }
 
 static void setup_sensor_data(struct ec_sensors_data *ec)
 {
 	struct ec_sensor *s = ec->sensors;
-	bool bank_found;
-	int i, j;
-	u8 bank;
-
-	ec->nr_banks = 0;
-	ec->nr_registers = 0;
+	int i;
 
-	for_each_set_bit(i, &ec->board_info->sensors,
-			 BITS_PER_TYPE(ec->board_info->sensors)) {
+	for_each_set_bit(i, &ec->board_info->sensors, ASUS_EC_MAX_SENSORS) {
 		s->info_index = i;
 		s->cached_value = 0;
-		ec->nr_registers +=
-			ec->sensors_info[s->info_index].addr.components.size;
-		bank_found = false;
-		bank = ec->sensors_info[s->info_index].addr.components.bank;
-		for (j = 0; j < ec->nr_banks; j++) {
-			if (ec->banks[j] == bank) {
-				bank_found = true;
-				break;
-			}
-		}
-		if (!bank_found) {
-			ec->banks[ec->nr_banks++] = bank;
-		}
+		s->present = true;
+		s->enabled = enabled_sensors & BIT(i);
 		s++;
 	}
-	sort(ec->banks, ec->nr_banks, 1, bank_compare, NULL);
 }
 
-static void fill_ec_registers(struct ec_sensors_data *ec)
+static void setup_derived_data(struct ec_sensors_data *ec)
+{
+	const struct ec_derived_info *di;
+	struct ec_derived *d;
+	unsigned int i, j;
+
+	for (i = 0; i < ec_derived_max; i++) {
+		di = &derived_sensors_info[i];
+		d = &ec->derived[i];
+		d->available = true;
+		for (j = 0; j < ARRAY_SIZE(d->operands); j++) {
+			d->available &= !!(ec->board_info->sensors &
+					   BIT(di->operands[j]));
+			d->operands[j] = sensor_index(ec, di->operands[j]);
+		}
+	}
+}
+
+/*
+ * (Re)builds the list of sensors to read from the board read plan, keeping
+ * only the active sensors
+ */
+static void setup_read_plan(struct ec_sensors_data *ec)
 {
 	const struct ec_sensor_info *si;
-	unsigned int i, j, register_idx = 0;
+	struct ec_bank_segment *seg;
+	unsigned int i, id, bank;
 
-	for (i = 0; i < ec->nr_sensors; ++i) {
-		si = get_sensor_info(ec, i);
-		for (j = 0; j < si->addr.components.size; ++j, ++register_idx) {
-			ec->registers[register_idx] =
-				(si->addr.components.bank << 8) +
-				si->addr.components.index + j;
+	ec->nr_banks = 0;
+	ec->nr_planned = 0;
+	ec->next_segment = 0;
+	ec->nr_registers = 0;
+
+	for (bank = 0; bank <= ASUS_EC_MAX_BANK; bank++) {
+		seg = &ec->segments[ec->nr_banks];
+		seg->bank = bank;
+		seg->first = ec->nr_planned;
+		seg->nr_registers = 0;
+		for_each_set_bit(id, &ec->board_info->bank_sensors[bank],
+				 ASUS_EC_MAX_SENSORS) {
+			i = sensor_index(ec, id);
+			if (!is_sensor_active(&ec->sensors[i]))
+				continue;
+			si = get_sensor_info(ec, i);
+			ec->read_plan[ec->nr_planned++] = i;
+			seg->nr_registers += si->addr.components.size;
+			ec->nr_registers += si->addr.components.size;
 		}
+		seg->end = ec->nr_planned;
+		if (seg->end != seg->first)
+			ec->nr_banks++;
 	}
 }
 
-static int setup_lock_data(struct device *dev)
+static int init_lock_data(struct device *dev, const char *mutex_path,
+			  struct lock_data *data)
 {
-	const char *mutex_path;
 	int status;
-	struct ec_sensors_data *state = dev_get_drvdata(dev);
-
-	mutex_path = mutex_path_override ?
-		mutex_path_override : state->board_info->mutex_path;
 
 	if (!mutex_path || !strlen(mutex_path)) {
 		dev_err(dev, "Hardware access guard mutex name is empty");
 		return -EINVAL;
 	}
 	if (!strcmp(mutex_path, ACPI_GLOBAL_LOCK_PSEUDO_PATH)) {
-		state->lock_data.mutex.glk = 0;
-		state->lock_data.lock = lock_via_global_acpi_lock;
-		state->lock_data.unlock = unlock_global_acpi_lock;
+		data->mutex.glk = 0;
+		data->lock = lock_via_global_acpi_lock;
+		data->unlock = unlock_global_acpi_lock;
+	} else if (!strcmp(mutex_path, LOCAL_LOCK_PSEUDO_PATH)) {
+		data->mutex.local = &asus_ec_local_lock;
+		data->lock = lock_via_local_mutex;
+		data->unlock = unlock_local_mutex;
 	} else {
 		status = acpi_get_handle(NULL, (acpi_string)mutex_path,
-					 &state->lock_data.mutex.aml);
+					 &data->mutex.aml);
 		if (ACPI_FAILURE(status)) {
 			dev_err(dev,
 				"Failed to get hardware access guard AML mutex '%s': error %d",
 				mutex_path, status);
 			return -ENOENT;
 		}
-		state->lock_data.lock = lock_via_acpi_mutex;
-		state->lock_data.unlock = unlock_acpi_mutex;
+		data->lock = lock_via_acpi_mutex;
+		data->unlock = unlock_acpi_mutex;
 	}
 	return 0;
 }
 
-static int asus_ec_bank_switch(u8 bank, u8 *old)
+static int setup_lock_data(struct device *dev)
 {
-	int status = 0;
+	const char *mutex_path;
+	struct ec_sensors_data *state = dev_get_drvdata(dev);
 
-	if (old) {
-		status = ec_read(ASUS_EC_BANK_REGISTER, old);
-	}
-	if (status || (old && (*old == bank)))
-		return status;
-	return ec_write(ASUS_EC_BANK_REGISTER, bank);
+	mutex_path = mutex_path_override ?
+		mutex_path_override : state->board_info->mutex_path;
+
+	return init_lock_data(dev, mutex_path, &state->lock_data);
 }
 
-static int asus_ec_block_read(const struct device *dev,
-			      struct ec_sensors_data *ec)
+static void benchmark_lock(struct device *dev, const char *mutex_path,
+			   unsigned int loops)
 {
-	int ireg, ibank, status;
-	u8 bank, reg_bank, prev_bank;
-
-	bank = 0;
-	status = asus_ec_bank_switch(bank, &prev_bank);
-	if (status) {
-		dev_warn(dev, "EC bank switch failed");
-		return status;
-	}
+	struct lock_data data;
+	unsigned int i;
+	ktime_t start;
+	s64 elapsed;
 
-	if (prev_bank) {
-		/* oops... somebody else is working with the EC too */
-		dev_warn(dev,
-			"Concurrent access to the ACPI EC detected.\nRace condition possible.");
-	}
+	if (init_lock_data(dev, mutex_path, &data))
+		return;
 
-	/* read registers minimizing bank switches. */
-	for (ibank = 0; ibank < ec->nr_banks; ibank++) {
-		if (bank != ec->banks[ibank]) {
-			bank = ec->banks[ibank];
-			if (asus_ec_bank_switch(bank, NULL)) {
-				dev_warn(dev, "EC bank switch to %d failed",
-					 bank);
-				break;
-			}
-		}
-		for (ireg = 0; ireg < ec->nr_registers; ireg++) {
-			reg_bank = register_bank(ec->registers[ireg]);
-			if (reg_bank < bank) {
-				continue;
-			}
-			ec_read(register_index(ec->registers[ireg]),
-				ec->read_buffer + ireg);
+	start = ktime_get();
+	for (i = 0; i < loops; i++) {
+		if (!data.lock(&data)) {
+			dev_warn(dev, "%s: failed to acquire lock", mutex_path);
+			return;
 		}
+		data.unlock(&data);
 	}
+	elapsed = ktime_to_ns(ktime_sub(ktime_get(), start));
 
-	status = asus_ec_bank_switch(prev_bank, NULL);
-	return status;
+	dev_info(dev, "%s: %lld ns per lock/unlock pair", mutex_path,
+		 div_s64(elapsed, loops));
 }
 
-static inline s32 get_sensor_value(const struct ec_sensor_info *si, u8 *data)
+/*
+ * Measures the cost of acquiring and releasing the driver-local lock
+ * against the ACPI locks the board could use
+ */
+static void benchmark_locks(struct device *dev, unsigned int loops)
 {
-	if (is_sensor_data_signed(si)) {
-		switch (si->addr.components.size) {
-		case 1:
-			return (s8)*data;
-		case 2:
-			return (s16)get_unaligned_be16(data);
-		case 4:
-			return (s32)get_unaligned_be32(data);
-		default:
-			return 0;
-		}
-	} else {
-		switch (si->addr.components.size) {
-		case 1:
-			return *data;
-		case 2:
-			return get_unaligned_be16(data);
-		case 4:
-			return get_unaligned_be32(data);
-		default:
-			return 0;
-		}
-	}
+	const struct ec_sensors_data *state = dev_get_drvdata(dev);
+	const char *board_mutex = state->board_info->mutex_path;
+
+	benchmark_lock(dev, LOCAL_LOCK_PSEUDO_PATH, loops);
+	benchmark_lock(dev, ACPI_GLOBAL_LOCK_PSEUDO_PATH, loops);
+	if (board_mutex && board_mutex[0] != ':')
+		benchmark_lock(dev, board_mutex, loops);
 }
 
-static void update_sensor_values(struct ec_sensors_data *ec, u8 *data)
+/*
+ * Forgets the cached bank selector. Regmap caches a written value before
+ * the bus write, so after a failed bank switch the cache claims a bank the
+ * EC is not switched to, and the following reads of that bank would skip
+ * the switch and return the registers of another bank.
+ */
+static void asus_ec_invalidate_bank(struct ec_sensors_data *ec)
 {
-	const struct ec_sensor_info *si;
-	struct ec_sensor *s, *sensor_end;
-
-	sensor_end = ec->sensors + ec->nr_sensors;
-	for (s = ec->sensors; s != sensor_end; s++) {
-		si = ec->sensors_info + s->info_index;
-		s->cached_value = get_sensor_value(si, data);
-		data += si->addr.components.size;
-	}
+	regcache_drop_region(ec->regmap, ASUS_EC_BANK_REGISTER,
+			     ASUS_EC_BANK_REGISTER);
 }
 
-static int update_ec_sensors(const struct device *dev,
-			     struct ec_sensors_data *ec)
+/*
+ * The banked EC registers are accessed via regmap, which switches banks
+ * as needed using the bank register as the page selector. The regmap
+ * lock is the hardware lock, so that any regmap user, including its
+ * debugfs interface, is guarded against the firmware. On taking the lock
+ * the currently selected bank is saved, and it is restored on release.
+ * The driver itself takes the lock for a sequence of regmap calls, hence
+ * the lock is recursive for its owner.
+ */
+static void asus_ec_regmap_lock(void *arg)
 {
-	int status;
+	struct ec_sensors_data *ec = arg;
+	ktime_t wait;
+	s64 wait_ns;
 
-	if (!ec->lock_data.lock(&ec->lock_data)) {
-		dev_warn(dev, "Failed to acquire mutex");
-		return -EBUSY;
+	if (READ_ONCE(ec->hw_lock_owner) == current) {
+		ec->hw_lock_depth++;
+		return;
 	}
 
-	status = asus_ec_block_read(dev, ec);
-
-	if (!status) {
-		update_sensor_values(ec, ec->read_buffer);
+	mutex_lock(&ec->hw_mutex);
+	WRITE_ONCE(ec->hw_lock_owner, current);
+	ec->hw_lock_depth = 1;
+	wait = ktime_get();
+	ec->hw_locked = ec->lock_data.lock(&ec->lock_data);
+	wait_ns = ktime_to_ns(ktime_sub(ktime_get(), wait));
+	if (wait_ns > ec->stats.lock_wait_max_ns)
+		ec->stats.lock_wait_max_ns = wait_ns;
+	if (wait_ns > ASUS_EC_LOCK_WAIT_SLOW_NS)
+		ec->stats.slow_lock_waits++;
+	if (!ec->hw_locked || !ec->regmap)
+		return;
+
+	/* the firmware might have switched the bank since we last held the lock */
+	asus_ec_invalidate_bank(ec);
+	if (regmap_read(ec->regmap, ASUS_EC_BANK_REGISTER, &ec->saved_bank)) {
+		dev_warn(ec->dev, "EC bank switch failed");
+		ec->saved_bank = 0;
+	} else if (ec->saved_bank) {
+		/* oops... somebody else is working with the EC too */
+		ec->stats.collisions++;
+		dev_warn_ratelimited(ec->dev,
+			"Concurrent access to the ACPI EC detected.\nRace condition possible.");
 	}
+}
 
-	if (!ec->lock_data.unlock(&ec->lock_data))
-		dev_err(dev, "Failed to release mutex");
+static void asus_ec_regmap_unlock(void *arg)
+{
+	struct ec_sensors_data *ec = arg;
 
+	if (ec->hw_lock_depth > 1) {
+		ec->hw_lock_depth--;
+		return;
+	}
+
+	if (ec->hw_locked) {
+		if (ec->regmap &&
+		    regmap_update_bits(ec->regmap, ASUS_EC_BANK_REGISTER, 0xff,
+				       ec->saved_bank)) {
+			dev_warn(ec->dev, "EC bank switch to %u failed",
+				 ec->saved_bank);
+			asus_ec_invalidate_bank(ec);
+		}
+		if (!ec->lock_data.unlock(&ec->lock_data))
+			dev_err(ec->dev, "Failed to release mutex");
+		ec->hw_locked = false;
+	}
+
+	ec->hw_lock_depth = 0;
+	WRITE_ONCE(ec->hw_lock_owner, NULL);
+	mutex_unlock(&ec->hw_mutex);
+}
+
+/* Acquires the hardware lock for a sequence of regmap calls */
+static int asus_ec_lock_hw(struct ec_sensors_data *ec)
+{
+	asus_ec_regmap_lock(ec);
+	if (ec->hw_locked)
+		return 0;
+
+	asus_ec_regmap_unlock(ec);
+	dev_warn(ec->dev, "Failed to acquire mutex");
+	return -EBUSY;
+}
+
+static void asus_ec_unlock_hw(struct ec_sensors_data *ec)
+{
+	asus_ec_regmap_unlock(ec);
+}
+
+static int asus_ec_regmap_reg_read(void *context, unsigned int reg,
+				   unsigned int *val)
+{
+	struct ec_sensors_data *ec = context;
+	u8 value;
+	int status;
+
+	if (!ec->hw_locked)
+		return -EBUSY;
+
+	status = ec_read(reg, &value);
+	if (!status)
+		*val = value;
+	return status;
+}
+
+static int asus_ec_regmap_reg_write(void *context, unsigned int reg,
+				    unsigned int val)
+{
+	struct ec_sensors_data *ec = context;
+
+	if (!ec->hw_locked)
+		return -EBUSY;
+
+	return ec_write(reg, val);
+}
+
+static const struct regmap_bus asus_ec_regmap_bus = {
+	.reg_read = asus_ec_regmap_reg_read,
+	.reg_write = asus_ec_regmap_reg_write,
+};
+
+static bool asus_ec_regmap_readable(struct device *dev, unsigned int reg)
+{
+	const struct ec_sensors_data *ec = dev_get_drvdata(dev);
+	const struct ec_sensor_info *si;
+	unsigned int i, first;
+
+	if (reg == ASUS_EC_BANK_REGISTER)
+		return true;
+
+	/* do not let debugfs wander around unknown registers */
+	for (i = 0; i < ec->nr_sensors; i++) {
+		si = get_sensor_info(ec, i);
+		first = sensor_register(si);
+		if (reg >= first && reg < first + si->addr.components.size)
+			return true;
+	}
+	return false;
+}
+
+static bool asus_ec_regmap_writeable(struct device *dev, unsigned int reg)
+{
+	return reg == ASUS_EC_BANK_REGISTER;
+}
+
+static bool asus_ec_regmap_volatile(struct device *dev, unsigned int reg)
+{
+	/*
+	 * Sensor values change all the time, but the selected bank only
+	 * changes while we hold the lock, when we switch it ourselves. The
+	 * cached selector is dropped when taking the lock and after failed
+	 * switches, see asus_ec_invalidate_bank().
+	 */
+	return reg != ASUS_EC_BANK_REGISTER;
+}
+
+static const struct regmap_range_cfg asus_ec_regmap_ranges[] = {
+	{
+		.name = "banks",
+		.range_min = ASUS_EC_REGMAP_BANKED_BASE,
+		.range_max = ASUS_EC_REGMAP_BANKED_BASE +
+			(ASUS_EC_MAX_BANK + 1) * ASUS_EC_BANK_SIZE - 1,
+		.selector_reg = ASUS_EC_BANK_REGISTER,
+		.selector_mask = 0xff,
+		.selector_shift = 0,
+		.window_start = 0,
+		.window_len = ASUS_EC_BANK_SIZE,
+	},
+};
+
+static int setup_regmap(struct ec_sensors_data *ec)
+{
+	struct regmap_config config = {
+		.name = "ec",
+		.reg_bits = 16,
+		.val_bits = 8,
+		.max_register = ASUS_EC_REGMAP_BANKED_BASE +
+			(ASUS_EC_MAX_BANK + 1) * ASUS_EC_BANK_SIZE - 1,
+		.readable_reg = asus_ec_regmap_readable,
+		.writeable_reg = asus_ec_regmap_writeable,
+		.volatile_reg = asus_ec_regmap_volatile,
+		.cache_type = REGCACHE_RBTREE,
+		.ranges = asus_ec_regmap_ranges,
+		.num_ranges = ARRAY_SIZE(asus_ec_regmap_ranges),
+		.lock = asus_ec_regmap_lock,
+		.unlock = asus_ec_regmap_unlock,
+		.lock_arg = ec,
+	};
+	struct regmap *regmap;
+
+	mutex_init(&ec->hw_mutex);
+
+	regmap = devm_regmap_init(ec->dev, &asus_ec_regmap_bus, ec, &config);
+	if (IS_ERR(regmap))
+		return PTR_ERR(regmap);
+
+	ec->regmap = regmap;
+	return 0;
+}
+
+static inline s32 get_sensor_value(const struct ec_sensor_info *si, u8 *data)
+{
+	if (is_sensor_data_signed(si)) {
+		switch (si->addr.components.size) {
+		case 1:
+			return (s8)*data;
+		case 2:
+			return (s16)get_unaligned_be16(data);
+		case 4:
+			return (s32)get_unaligned_be32(data);
+		default:
+			return 0;
+		}
+	} else {
+		switch (si->addr.components.size) {
+		case 1:
+			return *data;
+		case 2:
+			return get_unaligned_be16(data);
+		case 4:
+			return get_unaligned_be32(data);
+		default:
+			return 0;
+		}
+	}
+}
+
+/*
+ * Reads registers of any bank for other drivers, bypassing the regmap
+ * restrictions meant for debugfs. Has to be called with the hardware lock
+ * held, which restores the bank on release.
+ */
+static int asus_ec_read_bank_registers(struct ec_sensors_data *ec, u8 bank,
+				       u8 start, u8 len, u8 *buf)
+{
+	unsigned int i;
+	int status;
+
+	status = regmap_write(ec->regmap, ASUS_EC_BANK_REGISTER, bank);
+	if (status) {
+		asus_ec_invalidate_bank(ec);
+		return status;
+	}
+
+	for (i = 0; i < len; i++) {
+		status = ec_read(start + i, &buf[i]);
+		if (status)
+			return status;
+	}
+
+	return 0;
+}
+
+/* Has to be called with the hardware lock held */
+static int asus_ec_read_sensor_value(struct ec_sensors_data *ec,
+				     const struct ec_sensor_info *si,
+				     s32 *value)
+{
+	u8 data[ASUS_EC_MAX_SENSOR_SIZE];
+	int status;
+
+	if (!si->addr.components.size) {
+		*value = 0;
+		return 0;
+	}
+
+	status = regmap_bulk_read(ec->regmap, sensor_register(si), data,
+				  si->addr.components.size);
+	if (!status)
+		*value = get_sensor_value(si, data);
 	return status;
 }
 
-static long scale_sensor_value(s32 value, int data_type)
+/*
+ * EC transactions of reading a segment: a read per register plus switching
+ * to the bank and back
+ */
+static unsigned int segment_transactions(const struct ec_bank_segment *seg)
+{
+	return seg->nr_registers + 2;
+}
+
+/*
+ * Refills the transaction budget, allowing bursts of up to a second worth
+ * of transactions, but at least a refresh, so that a low budget slows
+ * refreshes down instead of stopping them.
+ * Has to be called with the update lock held.
+ */
+static void asus_ec_refill_budget(struct ec_sensors_data *ec)
+{
+	unsigned int transactions = ec->nr_registers + 2 * ec->nr_banks;
+	ktime_t now = ktime_get();
+	u64 capacity, elapsed;
+
+	if (!ec_transactions_per_sec)
+		return;
+
+	capacity = max((u64)ec_transactions_per_sec * NSEC_PER_SEC,
+		       (u64)transactions * NSEC_PER_SEC);
+	elapsed = ktime_to_ns(ktime_sub(now, ec->budget_updated));
+	if (elapsed >= div_u64(capacity, ec_transactions_per_sec))
+		ec->budget_tokens = capacity;
+	else
+		ec->budget_tokens = min(ec->budget_tokens +
+					elapsed * ec_transactions_per_sec,
+					capacity);
+	ec->budget_updated = now;
+}
+
+/* Has to be called with the update lock held */
+static bool asus_ec_budget_allows(const struct ec_sensors_data *ec,
+				  const struct ec_bank_segment *seg)
+{
+	return !ec_transactions_per_sec ||
+	       ec->budget_tokens >= (u64)segment_transactions(seg) * NSEC_PER_SEC;
+}
+
+/*
+ * Takes the transactions from the budget, returns false if they do not fit.
+ * Forced transactions are always taken, emptying the budget if needed.
+ * Has to be called with the update lock held.
+ */
+static bool asus_ec_charge_budget(struct ec_sensors_data *ec,
+				  unsigned int transactions, bool force)
+{
+	u64 cost = (u64)transactions * NSEC_PER_SEC;
+
+	if (!ec_transactions_per_sec)
+		return true;
+	if (ec->budget_tokens < cost) {
+		if (!force)
+			return false;
+		cost = ec->budget_tokens;
+	}
+
+	ec->budget_tokens -= cost;
+	ec->stats.budget_used += transactions;
+	return true;
+}
+
+/*
+ * Charges a read outside of the refreshes: a read per register plus
+ * switching to the bank and back. Returns false if it does not fit.
+ */
+static bool asus_ec_charge_read(struct ec_sensors_data *ec, unsigned int len)
+{
+	/* snapshot notifiers run with the update lock held */
+	bool locked = READ_ONCE(ec->notifying) == current;
+	bool ret;
+
+	if (!ec_transactions_per_sec)
+		return true;
+
+	if (!locked)
+		mutex_lock(&ec->update_lock);
+	asus_ec_refill_budget(ec);
+	ret = asus_ec_charge_budget(ec, len + 2, false);
+	if (!locked)
+		mutex_unlock(&ec->update_lock);
+
+	return ret;
+}
+
+/*
+ * Reads the sensors of a segment that were not read successfully yet and
+ * returns the number of the failed ones. A failure might come from the bank
+ * switch, hence the cached selector is dropped, so that the next read
+ * switches the bank again instead of reading another bank.
+ * Has to be called with the hardware lock held.
+ */
+static unsigned int asus_ec_read_segment(struct ec_sensors_data *ec,
+					 const struct ec_bank_segment *seg)
+{
+	unsigned int i, nr_failed = 0;
+	struct ec_sensor *s;
+	int status;
+
+	for (i = seg->first; i < seg->end; i++) {
+		s = &ec->sensors[ec->read_plan[i]];
+		if (s->read_ok)
+			continue;
+		status = asus_ec_read_sensor_value(ec,
+						   ec->sensors_info + s->info_index,
+						   &s->read_value);
+		if (status) {
+			asus_ec_invalidate_bank(ec);
+			s->errors++;
+			s->last_error = status;
+			ec->stats.read_errors++;
+			nr_failed++;
+			continue;
+		}
+		s->read_ok = true;
+	}
+
+	return nr_failed;
+}
+
+/*
+ * Reads sensors from the segments of the read plan in [*ibank, end_bank),
+ * advancing *ibank. Stops at a segment boundary once the deadline has
+ * passed or the next segment does not fit into the transaction budget,
+ * unless forced. A failed read, e.g. of the bank
+ * switch, does not stop the update: the failed sensors of the segment are
+ * read once again and the sensors that fail twice keep their previous
+ * values.
+ * Returns the number of the sensors that could not be read.
+ * Has to be called with the hardware lock held.
+ */
+static unsigned int asus_ec_block_read(const struct device *dev,
+				       struct ec_sensors_data *ec,
+				       unsigned int *ibank,
+				       unsigned int end_bank,
+				       ktime_t deadline, bool force)
+{
+	unsigned int i, nr_failed, total = 0;
+	struct ec_bank_segment *seg;
+
+	while (*ibank < end_bank) {
+		seg = &ec->segments[*ibank];
+		if (!asus_ec_charge_budget(ec, segment_transactions(seg),
+					   force))
+			break;
+		(*ibank)++;
+		for (i = seg->first; i < seg->end; i++)
+			ec->sensors[ec->read_plan[i]].read_ok = false;
+
+		nr_failed = asus_ec_read_segment(ec, seg);
+		if (nr_failed) {
+			ec->stats.read_retries++;
+			nr_failed = asus_ec_read_segment(ec, seg);
+		}
+		if (nr_failed)
+			dev_warn_ratelimited(dev,
+					     "EC read of %u sensors from bank %d failed",
+					     nr_failed, seg->bank);
+		seg->read_time = ktime_get();
+		total += nr_failed;
+
+		if (ktime_after(ktime_get(), deadline))
+			break;
+	}
+
+	return total;
+}
+
+/*
+ * Adds the energy spent since the previous sample to the counter, assuming
+ * the power changed linearly between the two samples.
+ */
+static void integrate_derived_value(struct ec_derived *d, s64 power,
+				    ktime_t now)
+{
+	u64 avg_power;
+
+	power = max_t(s64, power, 0);
+	if (d->last_time) {
+		/* [µW] * [ns] / 10^6 -> [nJ] */
+		avg_power = ((u64)d->last_power + power) / 2;
+		d->energy += mul_u64_u64_div_u64(avg_power,
+						 ktime_to_ns(ktime_sub(now, d->last_time)),
+						 USEC_PER_SEC);
+	}
+	d->last_power = power;
+	d->last_time = now;
+	d->value = div_u64(d->energy, NSEC_PER_USEC);
+}
+
+/*
+ * The sensor history.
+ *
+ * Raw samples are stored as deltas from the previous sample, zigzag and
+ * varint encoded, so that a typical sample takes 2 or 3 bytes. When the ring
+ * is full, the oldest samples are decoded and folded into the base sample.
+ * All the functions have to be called with the update lock held.
+ */
+
+static unsigned int history_encode_varint(u8 *buf, u32 value)
+{
+	unsigned int len = 0;
+
+	while (value >= 0x80) {
+		buf[len++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	buf[len++] = value;
+	return len;
+}
+
+static u32 history_decode_varint(const struct ec_history *h,
+				 unsigned int *pos)
+{
+	unsigned int shift = 0;
+	u32 value = 0;
+	u8 byte;
+
+	do {
+		byte = h->raw[*pos];
+		*pos = (*pos + 1) % history_bytes;
+		value |= (u32)(byte & 0x7f) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+
+	return value;
+}
+
+static u32 history_zigzag(s32 value)
+{
+	return ((u32)value << 1) ^ (u32)(value >> 31);
+}
+
+static s32 history_unzigzag(u32 value)
+{
+	return (s32)((value >> 1) ^ -(value & 1));
+}
+
+/* Decodes the sample at *pos into *time and *value, which hold the previous one */
+static void history_decode_raw(const struct ec_history *h, unsigned int *pos,
+			       s64 *time, s32 *value)
+{
+	*time += history_decode_varint(h, pos);
+	*value = (u32)*value + (u32)history_unzigzag(history_decode_varint(h, pos));
+}
+
+static void asus_ec_history_add_raw(struct ec_history *h, s64 time, s32 value)
+{
+	u8 record[ASUS_EC_HISTORY_MAX_RECORD];
+	unsigned int len, pos, i;
+
+	len = history_encode_varint(record,
+				    min_t(s64, time - h->last_time, U32_MAX));
+	/* wraps around for the largest deltas, decoding wraps back */
+	len += history_encode_varint(record + len,
+				     history_zigzag((u32)value - (u32)h->last_value));
+
+	while (history_bytes - h->raw_used < len) {
+		pos = h->raw_tail;
+		history_decode_raw(h, &pos, &h->base_time, &h->base_value);
+		h->raw_used -= (pos + history_bytes - h->raw_tail) % history_bytes;
+		h->raw_tail = pos;
+		h->nr_raw--;
+		h->first_raw++;
+	}
+
+	pos = (h->raw_tail + h->raw_used) % history_bytes;
+	for (i = 0; i < len; i++, pos = (pos + 1) % history_bytes)
+		h->raw[pos] = record[i];
+	h->raw_used += len;
+	h->nr_raw++;
+}
+
+static void history_accumulate(struct ec_history_accum *acc, u32 period,
+			       s32 min, s32 max, s64 sum, u32 count)
+{
+	if (!acc->count) {
+		acc->period = period;
+		acc->min = min;
+		acc->max = max;
+		acc->sum = 0;
+	}
+	acc->min = min(acc->min, min);
+	acc->max = max(acc->max, max);
+	acc->sum += sum;
+	acc->count += count;
+}
+
+static void history_summarize(struct ec_history_accum *acc,
+			      struct ec_history_summary *ring,
+			      unsigned int size, u32 *nr, u32 period_s)
+{
+	struct ec_history_summary *sum = &ring[*nr % size];
+
+	sum->start = acc->period * period_s;
+	sum->min = acc->min;
+	sum->avg = div_s64(acc->sum, acc->count);
+	sum->max = acc->max;
+	(*nr)++;
+	acc->count = 0;
+}
+
+static void asus_ec_history_add(struct ec_history *h, ktime_t now, s32 value)
+{
+	s64 time = ktime_to_ms(now);
+	u32 minute = div_u64(time, MSEC_PER_SEC * 60);
+
+	if (!h->started) {
+		h->base_time = time;
+		h->base_value = value;
+		h->last_time = time;
+		h->last_value = value;
+		h->started = true;
+	}
+
+	asus_ec_history_add_raw(h, time, value);
+	h->last_time = time;
+	h->last_value = value;
+
+	/* minutes roll up into hours when they are complete */
+	if (h->minute.count && h->minute.period != minute) {
+		if (h->hour.count && h->hour.period != h->minute.period / 60)
+			history_summarize(&h->hour, h->hours,
+					  ASUS_EC_HISTORY_HOURS, &h->nr_hours,
+					  60 * 60);
+		history_accumulate(&h->hour, h->minute.period / 60,
+				   h->minute.min, h->minute.max, h->minute.sum,
+				   h->minute.count);
+		history_summarize(&h->minute, h->minutes,
+				  ASUS_EC_HISTORY_MINUTES, &h->nr_minutes, 60);
+	}
+	history_accumulate(&h->minute, minute, value, value, value, 1);
+}
+
+static int asus_ec_history_init(struct ec_sensors_data *ec)
+{
+	unsigned int i;
+	u8 *raw;
+
+	ec->history = devm_kcalloc(ec->dev, ec->nr_sensors,
+				   sizeof(*ec->history), GFP_KERNEL);
+	raw = devm_kcalloc(ec->dev, ec->nr_sensors, history_bytes, GFP_KERNEL);
+	if (!ec->history || !raw)
+		return -ENOMEM;
+
+	for (i = 0; i < ec->nr_sensors; i++)
+		ec->history[i].raw = raw + i * history_bytes;
+	return 0;
+}
+
+/*
+ * Histogram buckets by sensor type, in raw sensor units. Values outside of
+ * the range are counted in the first or the last bucket.
+ */
+static const struct {
+	s32 low;
+	s32 width;
+} histogram_ranges[hwmon_max] = {
+	[hwmon_temp] = { .low = 0, .width = 4 },	/* 0 - 128 ℃ */
+	[hwmon_in] = { .low = 0, .width = 500 },	/* 0 - 16 V */
+	[hwmon_curr] = { .low = 0, .width = 8 },	/* 0 - 256 A */
+	[hwmon_fan] = { .low = 0, .width = 250 },	/* 0 - 8000 RPM */
+};
+
+/* Has to be called with the update lock held */
+static void update_histogram(struct ec_sensors_data *ec, unsigned int index)
+{
+	int type = get_sensor_info(ec, index)->type;
+	s32 bucket;
+
+	bucket = (ec->sensors[index].cached_value - histogram_ranges[type].low) /
+		 histogram_ranges[type].width;
+	bucket = clamp(bucket, 0, ASUS_EC_HISTOGRAM_BUCKETS - 1);
+	ec->histograms[index][bucket]++;
+}
+
+static long scale_sensor_value(s32 value, int data_type)
+{
+	switch (data_type) {
+	case hwmon_curr:
+	case hwmon_temp:
+		return value * MILLI;
+	default:
+		return value;
+	}
+}
+
+/*
+ * Schedules notifying the thermal core about zones whose temperature crossed
+ * a trip point in the new snapshot, so that it does not need to poll.
+ * Has to be called with the update lock held.
+ */
+static void asus_ec_thermal_check(struct ec_sensors_data *ec)
+{
+	struct ec_thermal_zone *zone;
+	bool schedule = false;
+	unsigned int i, j;
+	int temp;
+
+	for (i = 0; i < ec->nr_thermal_zones; i++) {
+		zone = &ec->thermal_zones[i];
+		if (!is_sensor_valid(&ec->sensors[zone->sensor]))
+			continue;
+
+		temp = ec->sensors[zone->sensor].cached_value *
+		       MILLIDEGREE_PER_DEGREE;
+		if (!zone->reported) {
+			zone->notify = true;
+			zone->reported = true;
+		}
+		for (j = 0; j < nr_thermal_trips; j++)
+			if ((zone->last_temp < thermal_trips[j]) !=
+			    (temp < thermal_trips[j]))
+				zone->notify = true;
+		zone->last_temp = temp;
+		schedule |= zone->notify;
+	}
+
+	if (schedule)
+		schedule_work(&ec->thermal_work);
+}
+
+/* Copies the latest snapshot, can be called from any context */
+static void asus_ec_read_snapshot(struct ec_sensors_data *ec,
+				  struct asus_ec_snapshot *snap)
+{
+	unsigned int seq;
+
+	do {
+		seq = raw_read_seqcount_latch(&ec->snapshot_seq);
+		*snap = ec->snapshots[seq & 1];
+	} while (raw_read_seqcount_latch_retry(&ec->snapshot_seq, seq));
+}
+
+/*
+ * The device serving other drivers, BPF, perf and netlink. These interfaces
+ * are not per device, so only the first bound device provides them, other
+ * instances only get hwmon and debugfs. The mutex serialises attaching and
+ * detaching, callers that sleep pin the device with asus_ec_pin_instance().
+ */
+static struct ec_sensors_data __rcu *asus_ec_instance;
+static DEFINE_MUTEX(asus_ec_instance_lock);
+
+static BLOCKING_NOTIFIER_HEAD(asus_ec_snapshot_notifiers);
+
+/**
+ * asus_ec_get_snapshot - copy the latest sensor snapshot
+ * @snap: buffer for the snapshot
+ *
+ * Does not access the EC and can be called from any context.
+ *
+ * Return: 0 on success, -ENODEV if the driver is not bound.
+ */
+int asus_ec_get_snapshot(struct asus_ec_snapshot *snap)
+{
+	struct ec_sensors_data *ec;
+	int ret = 0;
+
+	rcu_read_lock();
+	ec = rcu_dereference(asus_ec_instance);
+	if (ec)
+		asus_ec_read_snapshot(ec, snap);
+	else
+		ret = -ENODEV;
+	rcu_read_unlock();
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(asus_ec_get_snapshot);
+
+/* Keeps the exported device bound, returns NULL if there is none */
+static struct ec_sensors_data *asus_ec_pin_instance(void)
+{
+	struct ec_sensors_data *ec;
+
+	rcu_read_lock();
+	ec = rcu_dereference(asus_ec_instance);
+	if (ec)
+		atomic_inc(&ec->users);
+	rcu_read_unlock();
+
+	return ec;
+}
+
+static void asus_ec_unpin_instance(struct ec_sensors_data *ec)
+{
+	if (atomic_dec_and_test(&ec->users))
+		wake_up_var(&ec->users);
+}
+
+static void asus_ec_block_request_release(struct kref *ref)
+{
+	kfree(container_of(ref, struct ec_block_request, ref));
+}
+
+/* Has to be called with the update lock held */
+static void asus_ec_complete_block_request(struct ec_block_request *req,
+					   int status)
+{
+	req->status = status;
+	list_del(&req->node);
+	complete(&req->done);
+	kref_put(&req->ref, asus_ec_block_request_release);
+}
+
+static void asus_ec_instance_detach(void *data)
+{
+	struct ec_sensors_data *ec = data;
+	struct ec_block_request *req, *tmp;
+
+	mutex_lock(&asus_ec_instance_lock);
+	WRITE_ONCE(ec->exported, false);
+	RCU_INIT_POINTER(asus_ec_instance, NULL);
+	mutex_unlock(&asus_ec_instance_lock);
+	/* no new pins after that */
+	synchronize_rcu();
+	wait_var_event(&ec->users, !atomic_read(&ec->users));
+
+	/* batched requests whose callers stopped waiting */
+	mutex_lock(&ec->update_lock);
+	list_for_each_entry_safe(req, tmp, &ec->block_requests, node)
+		asus_ec_complete_block_request(req, -ENODEV);
+	mutex_unlock(&ec->update_lock);
+}
+
+/* Returns -EBUSY if another device is attached already */
+static int asus_ec_instance_attach(struct ec_sensors_data *ec)
+{
+	mutex_lock(&asus_ec_instance_lock);
+	if (rcu_access_pointer(asus_ec_instance)) {
+		mutex_unlock(&asus_ec_instance_lock);
+		return -EBUSY;
+	}
+	rcu_assign_pointer(asus_ec_instance, ec);
+	WRITE_ONCE(ec->exported, true);
+	mutex_unlock(&asus_ec_instance_lock);
+
+	return devm_add_action_or_reset(ec->dev, asus_ec_instance_detach, ec);
+}
+
+/**
+ * asus_ec_register_snapshot_notifier - subscribe to sensor snapshots
+ * @nb: notifier called with ASUS_EC_SNAPSHOT_UPDATED and a pointer to
+ *      struct asus_ec_snapshot after every refresh
+ *
+ * The notifier runs with the driver update lock held: it must not call
+ * back into the driver besides asus_ec_get_snapshot() and the block reads,
+ * and the snapshot is only valid during the call.
+ *
+ * Return: 0 on success, a negative error code otherwise.
+ */
+int asus_ec_register_snapshot_notifier(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_register(&asus_ec_snapshot_notifiers,
+						nb);
+}
+EXPORT_SYMBOL_GPL(asus_ec_register_snapshot_notifier);
+
+/**
+ * asus_ec_unregister_snapshot_notifier - unsubscribe from sensor snapshots
+ * @nb: notifier previously passed to asus_ec_register_snapshot_notifier()
+ *
+ * Return: 0 on success, a negative error code otherwise.
+ */
+int asus_ec_unregister_snapshot_notifier(struct notifier_block *nb)
+{
+	return blocking_notifier_chain_unregister(&asus_ec_snapshot_notifiers,
+						  nb);
+}
+EXPORT_SYMBOL_GPL(asus_ec_unregister_snapshot_notifier);
+
+#if IS_ENABLED(CONFIG_NET)
+
+/*
+ * Generic netlink family multicasting every new snapshot to the "snapshots"
+ * group, and replying with the latest one to ASUS_EC_CMD_GET_SNAPSHOT.
+ * Userspace has to mirror these definitions.
+ */
+#define ASUS_EC_GENL_NAME		"asus_ec"
+#define ASUS_EC_GENL_VERSION		1
+#define ASUS_EC_GENL_MCGRP_SNAPSHOTS	"snapshots"
+
+enum asus_ec_genl_commands {
+	ASUS_EC_CMD_UNSPEC,
+	/* request for the latest snapshot */
+	ASUS_EC_CMD_GET_SNAPSHOT,
+	/* a snapshot, either a reply or a multicast notification */
+	ASUS_EC_CMD_SNAPSHOT,
+	__ASUS_EC_CMD_MAX,
+};
+
+enum asus_ec_genl_attrs {
+	ASUS_EC_ATTR_UNSPEC,
+	/* u64, monotonic time of the refresh [ns] */
+	ASUS_EC_ATTR_TIMESTAMP,
+	/* u64, bit per sensor id with a valid value */
+	ASUS_EC_ATTR_VALID,
+	/* s32 array in hwmon units, indexed by sensor id (enum asus_ec_sensor) */
+	ASUS_EC_ATTR_VALUES,
+	ASUS_EC_ATTR_PAD,
+	/* u64 array, monotonic time each value was read at [ns] */
+	ASUS_EC_ATTR_READ_TIMES,
+	__ASUS_EC_ATTR_MAX,
+};
+
+static struct genl_family asus_ec_genl_family;
+static bool asus_ec_genl_registered;
+
+static int asus_ec_genl_fill(struct sk_buff *msg,
+			     const struct asus_ec_snapshot *snap,
+			     u32 portid, u32 seq)
+{
+	void *hdr;
+
+	hdr = genlmsg_put(msg, portid, seq, &asus_ec_genl_family, 0,
+			  ASUS_EC_CMD_SNAPSHOT);
+	if (!hdr)
+		return -EMSGSIZE;
+
+	if (nla_put_u64_64bit(msg, ASUS_EC_ATTR_TIMESTAMP, snap->timestamp,
+			      ASUS_EC_ATTR_PAD) ||
+	    nla_put_u64_64bit(msg, ASUS_EC_ATTR_VALID, snap->valid,
+			      ASUS_EC_ATTR_PAD) ||
+	    nla_put(msg, ASUS_EC_ATTR_VALUES, sizeof(snap->values),
+		    snap->values) ||
+	    nla_put(msg, ASUS_EC_ATTR_READ_TIMES, sizeof(snap->read_times),
+		    snap->read_times)) {
+		genlmsg_cancel(msg, hdr);
+		return -EMSGSIZE;
+	}
+
+	genlmsg_end(msg, hdr);
+	return 0;
+}
+
+static int asus_ec_genl_get_snapshot(struct sk_buff *skb,
+				     struct genl_info *info)
+{
+	struct asus_ec_snapshot snap;
+	struct sk_buff *msg;
+	int ret;
+
+	ret = asus_ec_get_snapshot(&snap);
+	if (ret)
+		return ret;
+
+	msg = genlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
+	if (!msg)
+		return -ENOMEM;
+
+	ret = asus_ec_genl_fill(msg, &snap, info->snd_portid, info->snd_seq);
+	if (ret) {
+		nlmsg_free(msg);
+		return ret;
+	}
+
+	return genlmsg_reply(msg, info);
+}
+
+static const struct genl_small_ops asus_ec_genl_ops[] = {
+	{
+		.cmd = ASUS_EC_CMD_GET_SNAPSHOT,
+		.doit = asus_ec_genl_get_snapshot,
+	},
+};
+
+static const struct genl_multicast_group asus_ec_genl_mcgrps[] = {
+	{ .name = ASUS_EC_GENL_MCGRP_SNAPSHOTS },
+};
+
+static struct genl_family asus_ec_genl_family = {
+	.name = ASUS_EC_GENL_NAME,
+	.version = ASUS_EC_GENL_VERSION,
+	.module = THIS_MODULE,
+	.small_ops = asus_ec_genl_ops,
+	.n_small_ops = ARRAY_SIZE(asus_ec_genl_ops),
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,1,0)
+	/* all the commands are new, hence strictly validated */
+	.resv_start_op = ASUS_EC_CMD_GET_SNAPSHOT,
+#endif
+	.mcgrps = asus_ec_genl_mcgrps,
+	.n_mcgrps = ARRAY_SIZE(asus_ec_genl_mcgrps),
+};
+
+/* Skips building the message when nobody listens */
+static void asus_ec_genl_notify(const struct asus_ec_snapshot *snap)
+{
+	struct sk_buff *msg;
+
+	if (!asus_ec_genl_registered ||
+	    !genl_has_listeners(&asus_ec_genl_family, &init_net, 0))
+		return;
+
+	msg = genlmsg_new(NLMSG_DEFAULT_SIZE, GFP_KERNEL);
+	if (!msg)
+		return;
+
+	if (asus_ec_genl_fill(msg, snap, 0, 0)) {
+		nlmsg_free(msg);
+		return;
+	}
+
+	genlmsg_multicast(&asus_ec_genl_family, msg, 0, 0, GFP_KERNEL);
+}
+
+static int asus_ec_genl_init(void)
+{
+	int status;
+
+	status = genl_register_family(&asus_ec_genl_family);
+	asus_ec_genl_registered = !status;
+	return status;
+}
+
+static void asus_ec_genl_exit(void)
+{
+	if (asus_ec_genl_registered)
+		genl_unregister_family(&asus_ec_genl_family);
+}
+
+#else
+
+static void asus_ec_genl_notify(const struct asus_ec_snapshot *snap)
+{
+}
+
+static int asus_ec_genl_init(void)
+{
+	return 0;
+}
+
+static void asus_ec_genl_exit(void)
+{
+}
+
+#endif /* IS_ENABLED(CONFIG_NET) */
+
+/* Has to be called with the update lock held */
+static void asus_ec_publish_snapshot(struct ec_sensors_data *ec, ktime_t now)
+{
+	struct asus_ec_snapshot snap = { .timestamp = ktime_to_ns(now) };
+	const struct ec_sensor_info *si;
+	struct ec_sensor *s;
+	unsigned int i;
+
+	for (i = 0; i < ec->nr_sensors; i++) {
+		s = &ec->sensors[i];
+		if (!is_sensor_valid(s))
+			continue;
+		si = get_sensor_info(ec, i);
+		snap.valid |= BIT_ULL(s->info_index);
+		snap.values[s->info_index] = scale_sensor_value(s->cached_value,
+								si->type);
+		snap.read_times[s->info_index] = ktime_to_ns(s->updated);
+	}
+
+	raw_write_seqcount_latch(&ec->snapshot_seq);
+	ec->snapshots[0] = snap;
+	raw_write_seqcount_latch(&ec->snapshot_seq);
+	ec->snapshots[1] = snap;
+
+	if (!READ_ONCE(ec->exported))
+		return;
+
+	asus_ec_genl_notify(&snap);
+	WRITE_ONCE(ec->notifying, current);
+	blocking_notifier_call_chain(&asus_ec_snapshot_notifiers,
+				     ASUS_EC_SNAPSHOT_UPDATED, &snap);
+	WRITE_ONCE(ec->notifying, NULL);
+}
+
+/* Has to be called with the update lock held */
+static s32 get_sensor_average(const struct ec_sensor *s)
+{
+	return s->average >> average_shift;
+}
+
+/*
+ * Exponential moving average with the weight of 1/2^average_shift for the
+ * new sample, restarted from the sample when the sensor was not read.
+ */
+static void update_sensor_average(struct ec_sensor *s)
+{
+	if (!s->average_valid) {
+		s->average = (s64)s->cached_value << average_shift;
+		s->average_valid = true;
+		return;
+	}
+	s->average += s->cached_value - get_sensor_average(s);
+}
+
+/*
+ * Publishes the sensors of the segments [first, end) read by the update,
+ * stamped with the read time of their segment, and counts the failures of
+ * those that could not be read. The other sensors keep their values.
+ */
+static void update_sensor_values(struct ec_sensors_data *ec, ktime_t now,
+				 unsigned int first, unsigned int end)
+{
+	const struct ec_derived_info *di;
+	const struct ec_bank_segment *seg;
+	struct ec_sensor *s, *a, *b;
+	/* sensors read by this update */
+	unsigned long fresh = 0;
+	struct ec_derived *d;
+	unsigned int i;
+	s64 value;
+
+	for (seg = &ec->segments[first]; seg < &ec->segments[end]; seg++) {
+		for (i = seg->first; i < seg->end; i++) {
+			s = &ec->sensors[ec->read_plan[i]];
+			/* a transient error leaves the previous value for a while */
+			if (!s->read_ok) {
+				if (++s->failures >= ASUS_EC_SENSOR_MAX_FAILURES)
+					s->valid = false;
+				continue;
+			}
+			s->cached_value = s->read_value;
+			s->valid = true;
+			s->updated = seg->read_time;
+			s->failures = 0;
+			fresh |= BIT(ec->read_plan[i]);
+			if (average_shift)
+				update_sensor_average(s);
+			if (ec->history)
+				asus_ec_history_add(&ec->history[ec->read_plan[i]],
+						    s->updated, s->cached_value);
+			if (ec->histograms)
+				update_histogram(ec, ec->read_plan[i]);
+		}
+	}
+
+	if (average_shift) {
+		for (i = 0; i < ec->nr_sensors; i++) {
+			s = &ec->sensors[i];
+			if (!is_sensor_valid(s))
+				s->average_valid = false;
+		}
+	}
+
+	/*
+	 * Operands have to come from the same refresh, which may not read
+	 * all the banks (see refresh_budget_us): the values are computed only
+	 * if the refresh read both the operands, and kept otherwise.
+	 */
+	for (i = 0; i < ec_derived_max; i++) {
+		d = &ec->derived[i];
+		if (!d->available)
+			continue;
+		a = &ec->sensors[d->operands[0]];
+		b = &ec->sensors[d->operands[1]];
+		di = &derived_sensors_info[i];
+		if (!is_sensor_valid(a) || !is_sensor_valid(b)) {
+			/* the counter stays readable, but stops counting */
+			if (di->integrate)
+				d->last_time = 0;
+			else
+				d->valid = false;
+			continue;
+		}
+		if (!(fresh & BIT(d->operands[0])) ||
+		    !(fresh & BIT(d->operands[1])))
+			continue;
+
+		value = di->compute(a->cached_value, b->cached_value);
+		/* sampled when the later of the operands was read */
+		if (di->integrate)
+			integrate_derived_value(d, value,
+						ktime_after(a->updated, b->updated) ?
+						a->updated : b->updated);
+		else
+			d->value = value;
+		d->valid = true;
+	}
+
+	asus_ec_publish_snapshot(ec, now);
+	asus_ec_thermal_check(ec);
+}
+
+/* Has to be called with the update lock and the hardware lock held */
+static void asus_ec_serve_block_requests(struct ec_sensors_data *ec)
+{
+	struct ec_block_request *req, *tmp;
+
+	list_for_each_entry_safe(req, tmp, &ec->block_requests, node) {
+		/* the callers are waiting already */
+		asus_ec_charge_budget(ec, req->len + 2, true);
+		asus_ec_complete_block_request(req,
+					       asus_ec_read_bank_registers(ec, req->bank,
+									   req->start,
+									   req->len,
+									   req->buf));
+	}
+}
+
+/* Has to be called with the update lock held */
+static void asus_ec_flush_block_requests(struct ec_sensors_data *ec)
+{
+	struct ec_block_request *req, *tmp;
+	int status;
+
+	status = asus_ec_lock_hw(ec);
+	if (!status) {
+		asus_ec_serve_block_requests(ec);
+		asus_ec_unlock_hw(ec);
+		return;
+	}
+
+	list_for_each_entry_safe(req, tmp, &ec->block_requests, node)
+		asus_ec_complete_block_request(req, status);
+}
+
+/*
+ * Returns -EAGAIN without touching the EC if the refresh does not fit
+ * into the transaction budget. Values of the sensors that were read are
+ * published even if some others failed, the update fails only if none
+ * could be read. With refresh_budget_us, or when the transaction budget
+ * runs out, the update may stop after any bank and the next one resumes
+ * from the following bank. A full update reads all the banks regardless
+ * of refresh_budget_us and the transaction budget, which is still charged.
+ */
+static int __update_ec_sensors(const struct device *dev,
+			       struct ec_sensors_data *ec, bool full)
+{
+	unsigned int ibank, first, end, nr_read = 0, nr_failed = 0;
+	ktime_t deadline = KTIME_MAX;
+	int status = 0;
+
+	lockdep_assert_held(&ec->update_lock);
+
+	/* the remaining segments are read when the budget allows */
+	asus_ec_refill_budget(ec);
+	first = ibank = full ? 0 : ec->next_segment;
+	if (!full && ibank < ec->nr_banks &&
+	    !asus_ec_budget_allows(ec, &ec->segments[ibank])) {
+		ec->stats.budget_deferrals++;
+		status = -EAGAIN;
+		goto out;
+	}
+
+	/*
+	 * Either read all the banks under a single lock acquisition, which
+	 * gives a consistent snapshot, or release the lock after each bank
+	 * to reduce the time the firmware has to wait for the EC.
+	 */
+	if (refresh_budget_us && !full)
+		deadline = ktime_add_us(ktime_get(), refresh_budget_us);
+
+	while (ibank < ec->nr_banks &&
+	       (full || asus_ec_budget_allows(ec, &ec->segments[ibank]))) {
+		status = asus_ec_lock_hw(ec);
+		if (status)
+			goto out;
+
+		end = release_lock_per_bank ? ibank + 1 : ec->nr_banks;
+		nr_failed += asus_ec_block_read(dev, ec, &ibank, end, deadline,
+						full);
+		/* pending block reads share the last lock acquisition */
+		if (ibank >= ec->nr_banks)
+			asus_ec_serve_block_requests(ec);
+
+		/* releasing the hardware lock restores the bank */
+		asus_ec_unlock_hw(ec);
+
+		if (ktime_after(ktime_get(), deadline))
+			break;
+	}
+
+	if (ibank < ec->nr_banks) {
+		ec->next_segment = ibank;
+		ec->stats.truncated_updates++;
+	} else {
+		ec->next_segment = 0;
+	}
+
+	if (ibank > first)
+		nr_read = ec->segments[ibank - 1].end - ec->segments[first].first;
+	if (nr_failed && nr_failed == nr_read) {
+		ec->stats.update_errors++;
+		/* counts the failures, so that the stale values expire */
+		update_sensor_values(ec, ktime_get(), first, ibank);
+		status = -EIO;
+		goto out;
+	}
+	if (nr_failed)
+		ec->stats.partial_updates++;
+
+	ec->last_sample_time = ktime_get();
+	update_sensor_values(ec, ec->last_sample_time, first, ibank);
+	ec->stats.updates++;
+
+out:
+	if (!list_empty(&ec->block_requests))
+		asus_ec_flush_block_requests(ec);
+	return status;
+}
+
+static int update_ec_sensors(const struct device *dev,
+			     struct ec_sensors_data *ec)
+{
+	return __update_ec_sensors(dev, ec, false);
+}
+
+/* Reads a single sensor bypassing the read plan */
+static int asus_ec_read_sensor(struct ec_sensors_data *ec,
+			       const struct ec_sensor_info *si, s32 *value)
+{
+	int status;
+
+	status = asus_ec_lock_hw(ec);
+	if (status)
+		return status;
+
+	status = asus_ec_read_sensor_value(ec, si, value);
+
+	asus_ec_unlock_hw(ec);
+	return status;
+}
+
+/*
+ * Queues a read for the next refresh and waits for it without keeping the
+ * device pinned: a detach fails the pending requests.
+ */
+static int asus_ec_queue_block_read(struct ec_sensors_data *ec, u8 bank,
+				    u8 start, u8 len, u8 *buf)
+{
+	struct ec_block_request *req;
+	long ret;
+	int status;
+
+	req = kzalloc(sizeof(*req), GFP_KERNEL);
+	if (!req) {
+		asus_ec_unpin_instance(ec);
+		return -ENOMEM;
+	}
+	req->bank = bank;
+	req->start = start;
+	req->len = len;
+	init_completion(&req->done);
+	/* one reference for the caller, one for the queue */
+	kref_init(&req->ref);
+	kref_get(&req->ref);
+
+	mutex_lock(&ec->update_lock);
+	list_add_tail(&req->node, &ec->block_requests);
+	mutex_unlock(&ec->update_lock);
+	asus_ec_unpin_instance(ec);
+
+	/* a sampling period, plus slack for deferred refreshes */
+	ret = wait_for_completion_killable_timeout(&req->done,
+						   msecs_to_jiffies(2 * sample_period_ms) + HZ);
+	if (ret > 0) {
+		status = req->status;
+		if (!status)
+			memcpy(buf, req->buf, len);
+	} else {
+		status = ret ? ret : -ETIMEDOUT;
+	}
+
+	kref_put(&req->ref, asus_ec_block_request_release);
+	return status;
+}
+
+static int asus_ec_submit_block_read(u8 bank, u8 start, u8 len, u8 *buf,
+				     bool batched)
+{
+	struct ec_sensors_data *ec;
+	int status;
+
+	if (!len || start + len > ASUS_EC_BANK_SIZE)
+		return -EINVAL;
+
+	ec = asus_ec_pin_instance();
+	if (!ec)
+		return -ENODEV;
+
+	/*
+	 * Snapshot notifiers run under the update lock, before the refresh
+	 * serves the queue, hence they can't wait for it.
+	 */
+	if (batched && sample_period_ms && READ_ONCE(ec->notifying) != current)
+		return asus_ec_queue_block_read(ec, bank, start, len, buf);
+
+	if (!asus_ec_charge_read(ec, len)) {
+		asus_ec_unpin_instance(ec);
+		return -EAGAIN;
+	}
+
+	status = asus_ec_lock_hw(ec);
+	if (!status) {
+		status = asus_ec_read_bank_registers(ec, bank, start, len, buf);
+		asus_ec_unlock_hw(ec);
+	}
+
+	asus_ec_unpin_instance(ec);
+	return status;
+}
+
+/**
+ * asus_ec_read_block - read a range of EC registers from a bank
+ * @bank: register bank
+ * @start: first register in the bank
+ * @len: number of registers, the range can't cross the bank end
+ * @buf: buffer for the register values
+ *
+ * Goes through the lock of this driver, so that the bank switching of the
+ * caller and of the driver do not interfere. May sleep.
+ *
+ * Return: 0 on success, -ENODEV if the driver is not bound, -EAGAIN if the
+ * read does not fit into the transaction budget (see ec_transactions_per_sec),
+ * a negative error code otherwise.
+ */
+int asus_ec_read_block(u8 bank, u8 start, u8 len, u8 *buf)
+{
+	return asus_ec_submit_block_read(bank, start, len, buf, false);
+}
+EXPORT_SYMBOL_GPL(asus_ec_read_block);
+
+/**
+ * asus_ec_read_block_batched - read a range of EC registers with the next
+ *                              refresh
+ * @bank: register bank
+ * @start: first register in the bank
+ * @len: number of registers, the range can't cross the bank end
+ * @buf: buffer for the register values
+ *
+ * Like asus_ec_read_block(), but with the fixed-rate sampler running (see
+ * sample_period_ms) waits for the next refresh to perform the read under
+ * its lock acquisition. Reads immediately otherwise, and when called from a
+ * snapshot notifier.
+ *
+ * Return: 0 on success, -ENODEV if the driver is not bound or is unbound
+ * while waiting, -ETIMEDOUT if no refresh served the request in time, a
+ * negative error code otherwise.
+ */
+int asus_ec_read_block_batched(u8 bank, u8 start, u8 len, u8 *buf)
+{
+	return asus_ec_submit_block_read(bank, start, len, buf, true);
+}
+EXPORT_SYMBOL_GPL(asus_ec_read_block_batched);
+
+/*
+ * Samples all the sensors a few times and excludes from the read plan
+ * those that constantly read the blank value. Returns the number of such
+ * sensors.
+ */
+static unsigned int detect_sensor_presence(struct ec_sensors_data *ec)
+{
+	unsigned long seen = 0;
+	unsigned int i, sample, nr_absent = 0;
+	struct ec_sensor *s;
+	int status;
+
+	for (sample = 0; sample < ASUS_EC_PRESENCE_SAMPLES; sample++) {
+		if (sample)
+			msleep(ASUS_EC_PRESENCE_SAMPLE_DELAY_MS);
+		mutex_lock(&ec->update_lock);
+		/* a bounded update may not reach all the sensors */
+		status = __update_ec_sensors(ec->dev, ec, true);
+		mutex_unlock(&ec->update_lock);
+		if (status)
+			return 0;
+		for (i = 0; i < ec->nr_sensors; i++) {
+			s = &ec->sensors[i];
+			if (!is_sensor_blank(get_sensor_info(ec, i),
+					     s->cached_value))
+				seen |= BIT(i);
+		}
+	}
+
+	for (i = 0; i < ec->nr_sensors; i++) {
+		if (seen & BIT(i))
+			continue;
+		ec->sensors[i].present = false;
+		nr_absent++;
+	}
+
+	if (nr_absent)
+		setup_read_plan(ec);
+	return nr_absent;
+}
+
+static void asus_ec_presence_work(struct work_struct *work)
+{
+	struct ec_sensors_data *ec = container_of(to_delayed_work(work),
+						  struct ec_sensors_data,
+						  presence_work);
+	const struct ec_sensor_info *si;
+	unsigned int i, nr_absent = 0;
+	bool changed = false;
+	struct ec_sensor *s;
+	s32 value;
+
+	mutex_lock(&ec->update_lock);
+
+	for (i = 0; i < ec->nr_sensors; i++) {
+		s = &ec->sensors[i];
+		if (s->present)
+			continue;
+		si = get_sensor_info(ec, i);
+		/* over the budget, the sensor is checked next time */
+		asus_ec_refill_budget(ec);
+		if (!asus_ec_charge_budget(ec, si->addr.components.size + 2,
+					   false) ||
+		    asus_ec_read_sensor(ec, si, &value) ||
+		    is_sensor_blank(si, value)) {
+			nr_absent++;
+			continue;
+		}
+		dev_info(ec->dev, "sensor %s connected", si->label);
+		s->present = true;
+		s->cached_value = value;
+		s->valid = true;
+		s->updated = ktime_get();
+		s->failures = 0;
+		changed = true;
+	}
+
+	if (changed)
+		setup_read_plan(ec);
+
+	mutex_unlock(&ec->update_lock);
+
+	if (nr_absent)
+		schedule_delayed_work(&ec->presence_work,
+				      presence_recheck_interval * HZ);
+}
+
+/* Has to be called with the update lock held */
+static int update_ec_sensors_if_stale(const struct device *dev,
+				      struct ec_sensors_data *state)
+{
+	int status;
+
+	/* the fixed-rate sampler, if enabled, keeps the values fresh */
+	if (sample_period_ms ||
+	    !time_after(jiffies, state->last_updated + HZ))
+		return 0;
+
+	status = update_ec_sensors(dev, state);
+	/* over the budget, readers get the cached values */
+	if (status == -EAGAIN)
+		return 0;
+	if (status) {
+		dev_err(dev, "update_ec_sensors() failure\n");
+		return -EIO;
+	}
+
+	state->last_updated = jiffies;
+	return 0;
+}
+
+static int get_cached_value_or_update(const struct device *dev,
+				      int sensor_index,
+				      struct ec_sensors_data *state, s32 *value,
+				      bool average)
+{
+	struct ec_sensor *s = &state->sensors[sensor_index];
+	int ret;
+
+	mutex_lock(&state->update_lock);
+
+	ret = update_ec_sensors_if_stale(dev, state);
+	if (ret)
+		goto unlock;
+
+	if (!is_sensor_valid(s) || (average && !s->average_valid)) {
+		ret = -ENODATA;
+		goto unlock;
+	}
+
+	*value = average ? get_sensor_average(s) : s->cached_value;
+
+unlock:
+	mutex_unlock(&state->update_lock);
+	return ret;
+}
+
+static int get_derived_value_or_update(const struct device *dev,
+				       int derived_index,
+				       struct ec_sensors_data *state,
+				       long *value)
+{
+	int ret;
+
+	mutex_lock(&state->update_lock);
+
+	ret = update_ec_sensors_if_stale(dev, state);
+	if (!ret) {
+		if (state->derived[derived_index].valid)
+			*value = state->derived[derived_index].value;
+		else
+			ret = -ENODATA;
+	}
+
+	mutex_unlock(&state->update_lock);
+	return ret;
+}
+
+/* Forces the next read to refresh the cached values */
+static void invalidate_sensor_values(struct ec_sensors_data *state)
+{
+	state->last_updated = jiffies - HZ - 1;
+}
+
+static void set_sensor_enabled(struct ec_sensors_data *state,
+			       int sensor_index, bool enabled)
+{
+	struct ec_sensor *s = &state->sensors[sensor_index];
+
+	mutex_lock(&state->update_lock);
+
+	if (s->enabled != enabled) {
+		s->enabled = enabled;
+		/* the value from before disabling is not worth reporting */
+		s->valid = false;
+		setup_read_plan(state);
+		if (enabled)
+			invalidate_sensor_values(state);
+	}
+
+	mutex_unlock(&state->update_lock);
+}
+
+/*
+ * Fixed-rate sampling: the hrtimer marks sampling deadlines and a high
+ * priority work reads the sensors, because the EC can't be accessed from
+ * the timer context.
+ */
+
+static enum hrtimer_restart asus_ec_sample_timer(struct hrtimer *timer)
+{
+	struct ec_sensors_data *ec = container_of(timer, struct ec_sensors_data,
+						  sample_timer);
+	s64 offset = READ_ONCE(ec->sample_offset_ns);
+	ktime_t now = ktime_get();
+	u64 overruns = 0;
+
+	/* the previous sample has not been taken yet */
+	if (!queue_work(system_highpri_wq, &ec->sample_work))
+		ec->stats.sampler_missed++;
+	else
+		WRITE_ONCE(ec->sample_deadline, hrtimer_get_expires(timer));
+
+	/* periods are counted from the base, so the offsets do not drift */
+	do {
+		ec->sample_base = ktime_add(ec->sample_base, ec->sample_period);
+		overruns++;
+	} while (!ktime_after(ktime_add_ns(ec->sample_base, offset), now));
+	if (overruns > 1)
+		ec->stats.sampler_missed += overruns - 1;
+
+	if (ec->sample_jitter_ns)
+		offset += get_random_u32_below(ec->sample_jitter_ns);
+	hrtimer_set_expires(timer, ktime_add_ns(ec->sample_base, offset));
+
+	return HRTIMER_RESTART;
+}
+
+/*
+ * Moves the sampling phase away from the firmware EC accesses. The period is
+ * split into slots, and collisions are counted for the slot the sampler is
+ * in. When the collision rate over a window gets too high, the sampler moves
+ * to the slot with the lowest rate seen, trying the unexplored ones first.
+ * Has to be called with the update lock held.
+ */
+static void asus_ec_adapt_phase(struct ec_sensors_data *ec, bool collided)
+{
+	struct ec_phase *ph = &ec->phase;
+	unsigned int i, best = ph->slot;
+
+	ph->slot_samples[ph->slot]++;
+	ph->slot_collisions[ph->slot] += collided;
+	if (ph->slot_samples[ph->slot] >= ASUS_EC_PHASE_HISTORY) {
+		ph->slot_samples[ph->slot] /= 2;
+		ph->slot_collisions[ph->slot] /= 2;
+	}
+	if (!ph->shifts) {
+		ph->initial_samples++;
+		ph->initial_collisions += collided;
+	}
+	ph->current_samples++;
+	ph->current_collisions += collided;
+
+	ph->window_samples++;
+	ph->window_collisions += collided;
+	if (ph->window_samples < ASUS_EC_PHASE_WINDOW)
+		return;
+
+	if (ph->window_collisions * ASUS_EC_PHASE_MAX_RATE >= ph->window_samples) {
+		for (i = 0; i < ASUS_EC_PHASE_SLOTS; i++) {
+			if (!ph->slot_samples[i]) {
+				best = i;
+				break;
+			}
+			if ((u64)ph->slot_collisions[i] * ph->slot_samples[best] <
+			    (u64)ph->slot_collisions[best] * ph->slot_samples[i])
+				best = i;
+		}
+	}
+	ph->window_samples = 0;
+	ph->window_collisions = 0;
+
+	if (best == ph->slot)
+		return;
+
+	ph->slot = best;
+	ph->shifts++;
+	ph->current_samples = 0;
+	ph->current_collisions = 0;
+	WRITE_ONCE(ec->sample_offset_ns,
+		   div_s64(ktime_to_ns(ec->sample_period) * best,
+			   ASUS_EC_PHASE_SLOTS));
+}
+
+static void asus_ec_sample_work(struct work_struct *work)
+{
+	struct ec_sensors_data *ec = container_of(work, struct ec_sensors_data,
+						  sample_work);
+	struct ec_stats *stats = &ec->stats;
+	u64 contention;
+	s64 jitter;
+
+	mutex_lock(&ec->update_lock);
+
+	jitter = ktime_to_ns(ktime_sub(ktime_get(),
+				       READ_ONCE(ec->sample_deadline)));
+	contention = READ_ONCE(stats->collisions) +
+		     READ_ONCE(stats->slow_lock_waits);
+	if (!update_ec_sensors(ec->dev, ec)) {
+		if (adaptive_phase)
+			asus_ec_adapt_phase(ec, READ_ONCE(stats->collisions) +
+						READ_ONCE(stats->slow_lock_waits) !=
+						contention);
+		ec->last_updated = jiffies;
+		if (!stats->sampler_samples || jitter < stats->jitter_min_ns)
+			stats->jitter_min_ns = jitter;
+		if (jitter > stats->jitter_max_ns)
+			stats->jitter_max_ns = jitter;
+		stats->jitter_sum_ns += jitter;
+		stats->sampler_samples++;
+	}
+
+	mutex_unlock(&ec->update_lock);
+}
+
+static void asus_ec_sampler_stop(void *data)
+{
+	struct ec_sensors_data *ec = data;
+
+	hrtimer_cancel(&ec->sample_timer);
+	cancel_work_sync(&ec->sample_work);
+}
+
+static int asus_ec_sampler_start(struct ec_sensors_data *ec,
+				 unsigned int period_ms)
+{
+	INIT_WORK(&ec->sample_work, asus_ec_sample_work);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,13,0)
+	hrtimer_init(&ec->sample_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	ec->sample_timer.function = asus_ec_sample_timer;
+#else
+	hrtimer_setup(&ec->sample_timer, asus_ec_sample_timer, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_ABS);
+#endif
+
+	ec->sample_period = ms_to_ktime(period_ms);
+	/* jitter within a slot decorrelates from periodic firmware accesses */
+	if (adaptive_phase)
+		ec->sample_jitter_ns = div_u64(ktime_to_ns(ec->sample_period),
+					       ASUS_EC_PHASE_SLOTS * 4);
+	ec->sample_base = ktime_get();
+	hrtimer_start(&ec->sample_timer, ec->sample_base, HRTIMER_MODE_ABS);
+
+	return devm_add_action_or_reset(ec->dev, asus_ec_sampler_stop, ec);
+}
+
+/*
+ * Now follow the functions that implement the hwmon interface
+ */
+
+static bool is_enable_attr(enum hwmon_sensor_types type, u32 attr)
+{
+	switch (type) {
+	case hwmon_temp:
+		return attr == hwmon_temp_enable;
+	case hwmon_in:
+		return attr == hwmon_in_enable;
+	case hwmon_curr:
+		return attr == hwmon_curr_enable;
+	case hwmon_fan:
+		return attr == hwmon_fan_enable;
+	default:
+		return false;
+	}
+}
+
+static bool is_average_attr(enum hwmon_sensor_types type, u32 attr)
+{
+	switch (type) {
+	case hwmon_in:
+		return attr == hwmon_in_average;
+	case hwmon_curr:
+		return attr == hwmon_curr_average;
+	default:
+		return false;
+	}
+}
+
+static int asus_ec_hwmon_read(struct device *dev, enum hwmon_sensor_types type,
+			      u32 attr, int channel, long *val)
+{
+	int ret;
+	s32 value = 0;
+
+	struct ec_sensors_data *state = dev_get_drvdata(dev);
+	int sidx = find_ec_sensor_index(state, type, channel);
+
+	if (sidx < 0) {
+		sidx = find_derived_index(state, type, channel);
+		if (sidx < 0)
+			return sidx;
+		return get_derived_value_or_update(dev, sidx, state, val);
+	}
+
+	if (is_enable_attr(type, attr)) {
+		*val = state->sensors[sidx].enabled;
+		return 0;
+	}
+
+	ret = get_cached_value_or_update(dev, sidx, state, &value,
+					 is_average_attr(type, attr));
+	if (!ret) {
+		*val = scale_sensor_value(value,
+					  get_sensor_info(state, sidx)->type);
+	}
+
+	return ret;
+}
+
+static int asus_ec_hwmon_read_string(struct device *dev,
+				     enum hwmon_sensor_types type, u32 attr,
+				     int channel, const char **str)
+{
+	struct ec_sensors_data *state = dev_get_drvdata(dev);
+	int sensor_index = find_ec_sensor_index(state, type, channel);
+
+	if (sensor_index < 0) {
+		sensor_index = find_derived_index(state, type, channel);
+		if (sensor_index < 0)
+			return sensor_index;
+		*str = derived_sensors_info[sensor_index].label;
+		return 0;
+	}
+
+	*str = get_sensor_info(state, sensor_index)->label;
+	return 0;
+}
+
+static int asus_ec_hwmon_write(struct device *dev, enum hwmon_sensor_types type,
+			       u32 attr, int channel, long val)
+{
+	struct ec_sensors_data *state = dev_get_drvdata(dev);
+	int sidx = find_ec_sensor_index(state, type, channel);
+
+	if (sidx < 0)
+		return sidx;
+
+	if (!is_enable_attr(type, attr))
+		return -EOPNOTSUPP;
+
+	if (val != 0 && val != 1)
+		return -EINVAL;
+
+	set_sensor_enabled(state, sidx, val);
+	return 0;
+}
+
+static umode_t asus_ec_hwmon_is_visible(const void *drvdata,
+					enum hwmon_sensor_types type, u32 attr,
+					int channel)
+{
+	const struct ec_sensors_data *state = drvdata;
+
+	if (find_ec_sensor_index(state, type, channel) < 0)
+		return find_derived_index(state, type, channel) < 0 ?
+			0 : S_IRUGO;
+
+	if (is_average_attr(type, attr) && !average_shift)
+		return 0;
+
+	return is_enable_attr(type, attr) ? S_IRUGO | S_IWUSR : S_IRUGO;
+}
+
+static const struct hwmon_ops asus_ec_hwmon_ops = {
+	.is_visible = asus_ec_hwmon_is_visible,
+	.read = asus_ec_hwmon_read,
+	.read_string = asus_ec_hwmon_read_string,
+	.write = asus_ec_hwmon_write,
+};
+
+/*
+ * Optional IIO interface, which allows to capture timestamped scans with
+ * a triggered buffer, e.g. using the hrtimer trigger
+ */
+
+#if IS_REACHABLE(CONFIG_IIO_TRIGGERED_BUFFER)
+
+struct asus_ec_iio_data {
+	struct ec_sensors_data *ec;
+	struct {
+		s32 values[ASUS_EC_MAX_SENSORS];
+		s64 timestamp __aligned(8);
+	} scan;
+};
+
+static const enum iio_chan_type asus_ec_iio_types[hwmon_max] = {
+	[hwmon_temp] = IIO_TEMP,
+	[hwmon_in] = IIO_VOLTAGE,
+	[hwmon_curr] = IIO_CURRENT,
+	[hwmon_fan] = IIO_ANGL_VEL,
+};
+
+/* IIO units are m°C, mV, mA and rad/s */
+static int asus_ec_iio_scale(enum hwmon_sensor_types type, int *val,
+			     int *val2)
+{
+	switch (type) {
+	case hwmon_temp:
+	case hwmon_curr:
+		*val = MILLI;
+		return IIO_VAL_INT;
+	case hwmon_in:
+		*val = 1;
+		return IIO_VAL_INT;
+	case hwmon_fan:
+		/* 2 * pi / 60 */
+		*val = 0;
+		*val2 = 104719755;
+		return IIO_VAL_INT_PLUS_NANO;
+	default:
+		return -EINVAL;
+	}
+}
+
+static int asus_ec_iio_read_raw(struct iio_dev *indio_dev,
+				struct iio_chan_spec const *chan, int *val,
+				int *val2, long mask)
+{
+	struct asus_ec_iio_data *data = iio_priv(indio_dev);
+	struct ec_sensors_data *ec = data->ec;
+	s32 value;
+	int ret;
+
+	switch (mask) {
+	case IIO_CHAN_INFO_RAW:
+		ret = get_cached_value_or_update(ec->dev, chan->address, ec,
+						 &value, false);
+		if (ret)
+			return ret;
+		*val = value;
+		return IIO_VAL_INT;
+	case IIO_CHAN_INFO_SCALE:
+		return asus_ec_iio_scale(get_sensor_info(ec, chan->address)->type,
+					 val, val2);
+	default:
+		return -EINVAL;
+	}
+}
+
+static int asus_ec_iio_read_label(struct iio_dev *indio_dev,
+				  struct iio_chan_spec const *chan, char *label)
+{
+	struct asus_ec_iio_data *data = iio_priv(indio_dev);
+
+	return sysfs_emit(label, "%s\n",
+			  get_sensor_info(data->ec, chan->address)->label);
+}
+
+static const struct iio_info asus_ec_iio_info = {
+	.read_raw = asus_ec_iio_read_raw,
+	.read_label = asus_ec_iio_read_label,
+};
+
+static irqreturn_t asus_ec_iio_trigger_handler(int irq, void *p)
+{
+	struct iio_poll_func *pf = p;
+	struct iio_dev *indio_dev = pf->indio_dev;
+	struct asus_ec_iio_data *data = iio_priv(indio_dev);
+	struct ec_sensors_data *ec = data->ec;
+	unsigned int i, j = 0;
+
+	mutex_lock(&ec->update_lock);
+
+	if (!update_ec_sensors(ec->dev, ec)) {
+		ec->last_updated = jiffies;
+		/* the last channel is the timestamp */
+		for (i = 0; i < indio_dev->num_channels - 1; i++) {
+			if (!test_bit(i, indio_dev->active_scan_mask))
+				continue;
+			data->scan.values[j++] =
+				ec->sensors[indio_dev->channels[i].address].cached_value;
+		}
+		iio_push_to_buffers_with_timestamp(indio_dev, &data->scan,
+						   iio_get_time_ns(indio_dev));
+	}
+
+	mutex_unlock(&ec->update_lock);
+
+	iio_trigger_notify_done(indio_dev->trig);
+	return IRQ_HANDLED;
+}
+
+static int asus_ec_iio_register(struct ec_sensors_data *ec)
+{
+	struct asus_ec_iio_data *data;
+	struct iio_chan_spec *channels, *chan;
+	enum hwmon_sensor_types type;
+	struct iio_dev *indio_dev;
+	unsigned int channel;
+	int status;
+
+	indio_dev = devm_iio_device_alloc(ec->dev, sizeof(*data));
+	if (!indio_dev)
+		return -ENOMEM;
+
+	channels = devm_kcalloc(ec->dev, ec->nr_sensors + 1,
+				sizeof(*channels), GFP_KERNEL);
+	if (!channels)
+		return -ENOMEM;
+
+	data = iio_priv(indio_dev);
+	data->ec = ec;
+
+	chan = channels;
+	for (type = 0; type < hwmon_max; type++) {
+		for (channel = 0; channel < nr_channels(ec, type); channel++) {
+			chan->type = asus_ec_iio_types[type];
+			chan->indexed = 1;
+			chan->channel = channel;
+			chan->address = find_ec_sensor_index(ec, type, channel);
+			chan->info_mask_separate = BIT(IIO_CHAN_INFO_RAW);
+			chan->info_mask_shared_by_type = BIT(IIO_CHAN_INFO_SCALE);
+			chan->scan_index = chan - channels;
+			chan->scan_type.sign = 's';
+			chan->scan_type.realbits = 32;
+			chan->scan_type.storagebits = 32;
+			chan->scan_type.endianness = IIO_CPU;
+			chan++;
+		}
+	}
+	*chan = (struct iio_chan_spec)IIO_CHAN_SOFT_TIMESTAMP(chan - channels);
+
+	indio_dev->name = "asusec";
+	indio_dev->info = &asus_ec_iio_info;
+	indio_dev->modes = INDIO_DIRECT_MODE;
+	indio_dev->channels = channels;
+	indio_dev->num_channels = ec->nr_sensors + 1;
+
+	status = devm_iio_triggered_buffer_setup(ec->dev, indio_dev, NULL,
+						 asus_ec_iio_trigger_handler,
+						 NULL);
+	if (status)
+		return status;
+
+	return devm_iio_device_register(ec->dev, indio_dev);
+}
+
+#else
+
+static int asus_ec_iio_register(struct ec_sensors_data *ec)
+{
+	dev_warn(ec->dev, "IIO triggered buffer support is not available");
+	return 0;
+}
+
+#endif /* IS_REACHABLE(CONFIG_IIO_TRIGGERED_BUFFER) */
+
+#if IS_REACHABLE(CONFIG_THERMAL) && LINUX_VERSION_CODE >= KERNEL_VERSION(6,4,0)
+
+/*
+ * Serves the thermal core from the latest snapshot, without taking the
+ * update lock or refreshing the sensors
+ */
+static int asus_ec_thermal_get_temp(struct thermal_zone_device *tzd, int *temp)
+{
+	struct ec_thermal_zone *zone = thermal_zone_device_priv(tzd);
+	struct ec_sensors_data *ec = zone->ec;
+	unsigned int id = ec->sensors[zone->sensor].info_index;
+	struct asus_ec_snapshot snap;
+
+	asus_ec_read_snapshot(ec, &snap);
+	if (!(snap.valid & BIT_ULL(id)))
+		return -ENODATA;
+
+	*temp = snap.values[id];
+	return 0;
+}
+
+static struct thermal_zone_device_ops asus_ec_thermal_ops = {
+	.get_temp = asus_ec_thermal_get_temp,
+};
+
+static void asus_ec_thermal_work(struct work_struct *work)
+{
+	struct ec_sensors_data *ec = container_of(work, struct ec_sensors_data,
+						  thermal_work);
+	unsigned long pending = 0;
+	unsigned int i;
+
+	mutex_lock(&ec->update_lock);
+	for (i = 0; i < ec->nr_thermal_zones; i++) {
+		if (ec->thermal_zones[i].notify)
+			__set_bit(i, &pending);
+		ec->thermal_zones[i].notify = false;
+	}
+	mutex_unlock(&ec->update_lock);
+
+	/* get_temp() takes the update lock */
+	for_each_set_bit(i, &pending, BITS_PER_LONG)
+		thermal_zone_device_update(ec->thermal_zones[i].tzd,
+					   THERMAL_EVENT_UNSPECIFIED);
+}
+
+static void asus_ec_thermal_unregister(void *data)
+{
+	struct ec_sensors_data *ec = data;
+	unsigned int i, nr_zones;
+
+	mutex_lock(&ec->update_lock);
+	nr_zones = ec->nr_thermal_zones;
+	ec->nr_thermal_zones = 0;
+	mutex_unlock(&ec->update_lock);
+
+	cancel_work_sync(&ec->thermal_work);
+	for (i = 0; i < nr_zones; i++)
+		thermal_zone_device_unregister(ec->thermal_zones[i].tzd);
+}
+
+/*
+ * Registers a thermal zone for each temperature sensor. The zones are pushed
+ * updates from the sensor refreshes when trip points are crossed, polling
+ * can be enabled in addition with thermal_polling_ms.
+ */
+static int asus_ec_thermal_register(struct ec_sensors_data *ec)
+{
+	unsigned int nr_zones = nr_channels(ec, hwmon_temp);
+	char type[THERMAL_NAME_LENGTH];
+	struct thermal_zone_device *tzd;
+	struct ec_thermal_zone *zone;
+	unsigned int i;
+	int status;
+
+	if (!sample_period_ms)
+		dev_warn(ec->dev,
+			 "Thermal zones only follow refreshes of other readers without sample_period_ms");
+
+	ec->thermal_zones = devm_kcalloc(ec->dev, nr_zones,
+					 sizeof(*ec->thermal_zones),
+					 GFP_KERNEL);
+	if (!ec->thermal_zones)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_thermal_trips; i++) {
+		ec->thermal_trips[i].temperature = thermal_trips[i];
+		ec->thermal_trips[i].hysteresis = ASUS_EC_THERMAL_HYSTERESIS;
+		ec->thermal_trips[i].type = THERMAL_TRIP_PASSIVE;
+	}
+
+	INIT_WORK(&ec->thermal_work, asus_ec_thermal_work);
+	status = devm_add_action_or_reset(ec->dev, asus_ec_thermal_unregister,
+					  ec);
+	if (status)
+		return status;
+
+	for (i = 0; i < nr_zones; i++) {
+		zone = &ec->thermal_zones[i];
+		zone->ec = ec;
+		zone->sensor = find_ec_sensor_index(ec, hwmon_temp, i);
+
+		strscpy(type, get_sensor_info(ec, zone->sensor)->label,
+			sizeof(type));
+		strreplace(type, ' ', '_');
+		tzd = thermal_zone_device_register_with_trips(type,
+							       ec->thermal_trips,
+							       nr_thermal_trips,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,9,0)
+							       0,
+#endif
+							       zone,
+							       &asus_ec_thermal_ops,
+							       NULL,
+							       thermal_polling_ms,
+							       thermal_polling_ms);
+		if (IS_ERR(tzd))
+			return PTR_ERR(tzd);
+
+		status = thermal_zone_device_enable(tzd);
+		if (status) {
+			thermal_zone_device_unregister(tzd);
+			return status;
+		}
+
+		zone->tzd = tzd;
+		mutex_lock(&ec->update_lock);
+		ec->nr_thermal_zones++;
+		mutex_unlock(&ec->update_lock);
+	}
+
+	return 0;
+}
+
+#else
+
+static int asus_ec_thermal_register(struct ec_sensors_data *ec)
+{
+	dev_warn(ec->dev, "Thermal zone support is not available");
+	return 0;
+}
+
+#endif /* IS_REACHABLE(CONFIG_THERMAL) */
+
+#if IS_ENABLED(CONFIG_DEBUG_INFO_BTF_MODULES) && LINUX_VERSION_CODE >= KERNEL_VERSION(6,9,0)
+
+__bpf_kfunc_start_defs();
+
+/**
+ * bpf_asus_ec_read_snapshot - copy the latest sensor snapshot
+ * @snap: buffer for the snapshot
+ * @snap__sz: size of the buffer, has to be sizeof(struct asus_ec_snapshot)
+ *
+ * Does not access the EC and does not sleep.
+ *
+ * Return: 0 on success, -ENODEV if the driver is not bound, -EINVAL on
+ * size mismatch.
+ */
+__bpf_kfunc int bpf_asus_ec_read_snapshot(struct asus_ec_snapshot *snap,
+					  u32 snap__sz)
+{
+	if (snap__sz != sizeof(*snap))
+		return -EINVAL;
+
+	return asus_ec_get_snapshot(snap);
+}
+
+__bpf_kfunc_end_defs();
+
+BTF_KFUNCS_START(asus_ec_kfunc_ids)
+BTF_ID_FLAGS(func, bpf_asus_ec_read_snapshot)
+BTF_KFUNCS_END(asus_ec_kfunc_ids)
+
+static const struct btf_kfunc_id_set asus_ec_kfunc_set = {
+	.owner = THIS_MODULE,
+	.set = &asus_ec_kfunc_ids,
+};
+
+static int asus_ec_bpf_init(void)
+{
+	/* the kfunc does not depend on program type */
+	return register_btf_kfunc_id_set(BPF_PROG_TYPE_UNSPEC,
+					 &asus_ec_kfunc_set);
+}
+
+#else
+
+static int asus_ec_bpf_init(void)
+{
+	return 0;
+}
+
+#endif /* IS_ENABLED(CONFIG_DEBUG_INFO_BTF_MODULES) */
+
+#if IS_ENABLED(CONFIG_PERF_EVENTS)
+
+/*
+ * The "asus_ec" PMU. The sensors are gauges rather than counters, so an event
+ * count is the sensor value from the latest snapshot, not a sum. The events
+ * are system-wide and can't sample, but can be read as members of sampling
+ * groups, because reading the snapshot does not touch the EC.
+ */
+struct asus_ec_pmu {
+	struct pmu pmu;
+	struct ec_sensors_data *ec;
+	struct attribute_group events_group;
+	const struct attribute_group *attr_groups[4];
+};
+
+/* name, unit and scale per sensor */
+#define ASUS_EC_PMU_ATTRS_PER_EVENT	3
+
+static const char *const asus_ec_pmu_units[hwmon_max] = {
+	[hwmon_temp] = "C",
+	[hwmon_in] = "V",
+	[hwmon_curr] = "A",
+	[hwmon_fan] = "RPM",
+};
+
+PMU_FORMAT_ATTR(event, "config:0-7");
+
+static struct attribute *asus_ec_pmu_format_attrs[] = {
+	&format_attr_event.attr,
+	NULL,
+};
+
+static const struct attribute_group asus_ec_pmu_format_group = {
+	.name = "format",
+	.attrs = asus_ec_pmu_format_attrs,
+};
+
+static ssize_t cpumask_show(struct device *dev, struct device_attribute *attr,
+			    char *buf)
+{
+	return sysfs_emit(buf, "0\n");
+}
+static DEVICE_ATTR_RO(cpumask);
+
+static struct attribute *asus_ec_pmu_cpumask_attrs[] = {
+	&dev_attr_cpumask.attr,
+	NULL,
+};
+
+static const struct attribute_group asus_ec_pmu_cpumask_group = {
+	.attrs = asus_ec_pmu_cpumask_attrs,
+};
+
+static struct asus_ec_pmu *to_asus_ec_pmu(struct pmu *pmu)
+{
+	return container_of(pmu, struct asus_ec_pmu, pmu);
+}
+
+static int asus_ec_pmu_event_init(struct perf_event *event)
+{
+	struct asus_ec_pmu *ep = to_asus_ec_pmu(event->pmu);
+	u64 config = event->attr.config;
+
+	if (event->attr.type != event->pmu->type)
+		return -ENOENT;
+
+	if (is_sampling_event(event) || event->cpu < 0)
+		return -EINVAL;
+
+	if (config >= ASUS_EC_MAX_SENSORS ||
+	    !(ep->ec->board_info->sensors & BIT(config)))
+		return -EINVAL;
+
+	return 0;
+}
+
+static void asus_ec_pmu_read(struct perf_event *event)
+{
+	struct asus_ec_pmu *ep = to_asus_ec_pmu(event->pmu);
+	struct asus_ec_snapshot snap;
+	u64 config = event->attr.config;
+
+	asus_ec_read_snapshot(ep->ec, &snap);
+	/* an absent or disabled sensor keeps the last value */
+	if (snap.valid & BIT_ULL(config))
+		local64_set(&event->count, snap.values[config]);
+}
+
+static void asus_ec_pmu_start(struct perf_event *event, int flags)
+{
+	event->hw.state = 0;
+	asus_ec_pmu_read(event);
+}
+
+static void asus_ec_pmu_stop(struct perf_event *event, int flags)
+{
+	if (flags & PERF_EF_UPDATE)
+		asus_ec_pmu_read(event);
+	event->hw.state = PERF_HES_STOPPED;
+}
+
+static int asus_ec_pmu_add(struct perf_event *event, int flags)
+{
+	if (flags & PERF_EF_START)
+		asus_ec_pmu_start(event, flags);
+	else
+		event->hw.state = PERF_HES_STOPPED;
+	return 0;
+}
+
+static void asus_ec_pmu_del(struct perf_event *event, int flags)
+{
+	asus_ec_pmu_stop(event, PERF_EF_UPDATE);
+}
+
+static void asus_ec_pmu_unregister(void *data)
+{
+	perf_pmu_unregister(data);
+}
+
+static int asus_ec_pmu_init_event_attr(struct device *dev,
+				       struct perf_pmu_events_attr *attr,
+				       const char *name, const char *suffix,
+				       const char *value)
+{
+	attr->attr.attr.name = devm_kasprintf(dev, GFP_KERNEL, "%s%s", name,
+					      suffix);
+	if (!attr->attr.attr.name || !value)
+		return -ENOMEM;
+
+	sysfs_attr_init(&attr->attr.attr);
+	attr->attr.attr.mode = 0444;
+	attr->attr.show = perf_event_sysfs_show;
+	attr->event_str = value;
+	return 0;
+}
+
+/* Events are named after the sensors, as in "vrm_temp" or "cpu_opt_fan" */
+static int asus_ec_pmu_register(struct ec_sensors_data *ec)
+{
+	const unsigned int nr_attrs = ec->nr_sensors * ASUS_EC_PMU_ATTRS_PER_EVENT;
+	const struct ec_sensor_info *si;
+	struct perf_pmu_events_attr *attrs, *attr;
+	struct attribute **event_attrs;
+	struct asus_ec_pmu *ep;
+	unsigned int i, id;
+	char *name;
+	int status;
+
+	ep = devm_kzalloc(ec->dev, sizeof(*ep), GFP_KERNEL);
+	attrs = devm_kcalloc(ec->dev, nr_attrs, sizeof(*attrs), GFP_KERNEL);
+	event_attrs = devm_kcalloc(ec->dev, nr_attrs + 1, sizeof(*event_attrs),
+				   GFP_KERNEL);
+	if (!ep || !attrs || !event_attrs)
+		return -ENOMEM;
+
+	for (i = 0, attr = attrs; i < ec->nr_sensors; i++) {
+		si = get_sensor_info(ec, i);
+		id = ec->sensors[i].info_index;
+
+		name = devm_kasprintf(ec->dev, GFP_KERNEL, "%s_%s", si->label,
+				      sensor_type_names[si->type]);
+		if (!name)
+			return -ENOMEM;
+		string_lower(name, name);
+		strreplace(name, ' ', '_');
+
+		status = asus_ec_pmu_init_event_attr(ec->dev, attr++, name, "",
+						     devm_kasprintf(ec->dev, GFP_KERNEL,
+								    "event=0x%02x", id));
+		if (status)
+			return status;
+		status = asus_ec_pmu_init_event_attr(ec->dev, attr++, name, ".unit",
+						     asus_ec_pmu_units[si->type]);
+		if (status)
+			return status;
+		/* the snapshot holds hwmon units, milli- except for fans */
+		status = asus_ec_pmu_init_event_attr(ec->dev, attr++, name, ".scale",
+						     si->type == hwmon_fan ?
+							"1" : "0.001");
+		if (status)
+			return status;
+	}
+
+	for (i = 0; i < nr_attrs; i++)
+		event_attrs[i] = &attrs[i].attr.attr;
+
+	ep->ec = ec;
+	ep->events_group.name = "events";
+	ep->events_group.attrs = event_attrs;
+	ep->attr_groups[0] = &asus_ec_pmu_format_group;
+	ep->attr_groups[1] = &ep->events_group;
+	ep->attr_groups[2] = &asus_ec_pmu_cpumask_group;
+	ep->pmu = (struct pmu) {
+		.module = THIS_MODULE,
+		.attr_groups = ep->attr_groups,
+		.task_ctx_nr = perf_invalid_context,
+		.capabilities = PERF_PMU_CAP_NO_EXCLUDE,
+		.event_init = asus_ec_pmu_event_init,
+		.add = asus_ec_pmu_add,
+		.del = asus_ec_pmu_del,
+		.start = asus_ec_pmu_start,
+		.stop = asus_ec_pmu_stop,
+		.read = asus_ec_pmu_read,
+	};
+
+	status = perf_pmu_register(&ep->pmu, "asus_ec", -1);
+	if (status)
+		return status;
+
+	return devm_add_action_or_reset(ec->dev, asus_ec_pmu_unregister,
+					&ep->pmu);
+}
+
+#else
+
+static int asus_ec_pmu_register(struct ec_sensors_data *ec)
+{
+	dev_warn(ec->dev, "perf events support is not available");
+	return 0;
+}
+
+#endif /* IS_ENABLED(CONFIG_PERF_EVENTS) */
+
+/*
+ * Burst capture: writing "<sensor mask> <samples> <period in us>" into the
+ * "capture" debugfs file starts reading only the selected sensors (bit
+ * numbers follow enum ec_sensors) at the given rate, period 0 meaning as
+ * fast as possible, and "stop" aborts the capture. Reading the file waits
+ * for the capture to finish and returns one line per sample: monotonic
+ * timestamp in ns followed by raw sensor values. The capture runs at the
+ * requested rate regardless of ec_transactions_per_sec.
+ */
+
+static void asus_ec_capture_work(struct work_struct *work)
+{
+	struct ec_capture *cap = container_of(work, struct ec_capture, work);
+	struct ec_sensors_data *ec = container_of(cap, struct ec_sensors_data,
+						  capture);
+	const struct ec_sensor_info *si;
+	unsigned int n, i;
+	ktime_t start;
+	s64 delay_us;
+	s32 *values;
+	int status = 0;
+
+	start = ktime_get();
+	for (n = 0; n < cap->nr_samples && !READ_ONCE(cap->abort); n++) {
+		delay_us = ktime_us_delta(ktime_add_us(start,
+						       (u64)n * cap->period_us),
+					  ktime_get());
+		if (delay_us > 0)
+			usleep_range(delay_us,
+				     delay_us + ASUS_EC_CAPTURE_SLACK_US);
+
+		status = asus_ec_lock_hw(ec);
+		if (status)
+			break;
+
+		cap->timestamps[n] = ktime_get_ns();
+		values = cap->values + n * cap->nr_sensors;
+		for (i = 0; !status && i < cap->nr_sensors; i++) {
+			si = get_sensor_info(ec, cap->sensors[i]);
+			status = asus_ec_read_sensor_value(ec, si, values + i);
+		}
+
+		asus_ec_unlock_hw(ec);
+		if (status)
+			break;
+	}
+
+	cap->nr_captured = n;
+	cap->status = status;
+	WRITE_ONCE(cap->running, false);
+	complete_all(&cap->done);
+}
+
+static int asus_ec_capture_arm(struct ec_sensors_data *ec, unsigned long mask,
+			       unsigned int nr_samples, unsigned int period_us)
+{
+	struct ec_capture *cap = &ec->capture;
+	unsigned int i, bank;
+	int ret = 0;
+
+	if (!mask || (mask & ~ec->board_info->sensors) || !nr_samples ||
+	    nr_samples > ASUS_EC_CAPTURE_MAX_SAMPLES ||
+	    period_us > ASUS_EC_CAPTURE_MAX_PERIOD_US)
+		return -EINVAL;
+
+	mutex_lock(&cap->lock);
+
+	if (cap->running) {
+		ret = -EBUSY;
+		goto unlock;
+	}
+
+	kvfree(cap->timestamps);
+	kvfree(cap->values);
+	cap->nr_captured = 0;
+	cap->nr_sensors = 0;
+	cap->values = NULL;
+	cap->timestamps = kvcalloc(nr_samples, sizeof(*cap->timestamps),
+				   GFP_KERNEL);
+	if (!cap->timestamps) {
+		ret = -ENOMEM;
+		goto unlock;
+	}
+
+	/* minimal read plan: the selected sensors only, grouped by bank */
+	for (bank = 0; bank <= ASUS_EC_MAX_BANK; bank++) {
+		for (i = 0; i < ec->nr_sensors; i++) {
+			if (!(mask & BIT(ec->sensors[i].info_index)) ||
+			    get_sensor_info(ec, i)->addr.components.bank != bank)
+				continue;
+			cap->sensors[cap->nr_sensors++] = i;
+		}
+	}
+
+	cap->values = kvcalloc(nr_samples * cap->nr_sensors,
+			       sizeof(*cap->values), GFP_KERNEL);
+	if (!cap->values) {
+		ret = -ENOMEM;
+		goto unlock;
+	}
+
+	cap->nr_samples = nr_samples;
+	cap->period_us = period_us;
+	cap->status = 0;
+	cap->abort = false;
+	cap->running = true;
+	reinit_completion(&cap->done);
+	queue_work(system_long_wq, &cap->work);
+
+unlock:
+	mutex_unlock(&cap->lock);
+	return ret;
+}
+
+static ssize_t asus_ec_capture_write(struct file *file,
+				     const char __user *user_buf,
+				     size_t count, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	struct ec_sensors_data *ec = m->private;
+	unsigned int nr_samples, period_us;
+	unsigned long mask;
+	char buf[64];
+	int ret;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, user_buf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+
+	if (sysfs_streq(buf, "stop")) {
+		WRITE_ONCE(ec->capture.abort, true);
+		return count;
+	}
+
+	if (sscanf(buf, "%li %u %u", &mask, &nr_samples, &period_us) != 3)
+		return -EINVAL;
+
+	ret = asus_ec_capture_arm(ec, mask, nr_samples, period_us);
+	return ret ? ret : count;
+}
+
+static void *asus_ec_capture_seq_start(struct seq_file *m, loff_t *pos)
 {
-	switch (data_type) {
-	case hwmon_curr:
-	case hwmon_temp:
-		return value * MILLI;
-	default:
-		return value;
+	struct ec_sensors_data *ec = m->private;
+	struct ec_capture *cap = &ec->capture;
+
+	mutex_lock(&cap->lock);
+
+	if (cap->running || *pos > cap->nr_captured)
+		return NULL;
+	return *pos ? pos : SEQ_START_TOKEN;
+}
+
+static void *asus_ec_capture_seq_next(struct seq_file *m, void *v,
+				      loff_t *pos)
+{
+	struct ec_sensors_data *ec = m->private;
+
+	++*pos;
+	return *pos > ec->capture.nr_captured ? NULL : pos;
+}
+
+static void asus_ec_capture_seq_stop(struct seq_file *m, void *v)
+{
+	struct ec_sensors_data *ec = m->private;
+
+	mutex_unlock(&ec->capture.lock);
+}
+
+static int asus_ec_capture_seq_show(struct seq_file *m, void *v)
+{
+	struct ec_sensors_data *ec = m->private;
+	struct ec_capture *cap = &ec->capture;
+	unsigned int n, i;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_printf(m, "# status %d, time_ns", cap->status);
+		for (i = 0; i < cap->nr_sensors; i++)
+			seq_printf(m, " \"%s\"",
+				   get_sensor_info(ec, cap->sensors[i])->label);
+		seq_putc(m, '\n');
+		return 0;
 	}
+
+	n = *(loff_t *)v - 1;
+	seq_printf(m, "%lld", cap->timestamps[n]);
+	for (i = 0; i < cap->nr_sensors; i++)
+		seq_printf(m, " %d", cap->values[n * cap->nr_sensors + i]);
+	seq_putc(m, '\n');
+	return 0;
 }
 
-static int get_cached_value_or_update(const struct device *dev,
-				      int sensor_index,
-				      struct ec_sensors_data *state, s32 *value)
+static const struct seq_operations asus_ec_capture_seq_ops = {
+	.start = asus_ec_capture_seq_start,
+	.next = asus_ec_capture_seq_next,
+	.stop = asus_ec_capture_seq_stop,
+	.show = asus_ec_capture_seq_show,
+};
+
+static int asus_ec_capture_open(struct inode *inode, struct file *file)
 {
-	if (time_after(jiffies, state->last_updated + HZ)) {
-		if (update_ec_sensors(dev, state)) {
-			dev_err(dev, "update_ec_sensors() failure\n");
-			return -EIO;
-		}
+	struct ec_sensors_data *ec = inode->i_private;
+	int ret;
+
+	/* readers get the result of the running capture */
+	if (file->f_mode & FMODE_READ) {
+		ret = wait_for_completion_interruptible(&ec->capture.done);
+		if (ret)
+			return ret;
+	}
+
+	ret = seq_open(file, &asus_ec_capture_seq_ops);
+	if (!ret)
+		((struct seq_file *)file->private_data)->private = ec;
+	return ret;
+}
+
+static const struct file_operations asus_ec_capture_fops = {
+	.owner = THIS_MODULE,
+	.open = asus_ec_capture_open,
+	.read = seq_read,
+	.write = asus_ec_capture_write,
+	.llseek = seq_lseek,
+	.release = seq_release,
+};
+
+static void asus_ec_capture_cleanup(void *data)
+{
+	struct ec_capture *cap = data;
+
+	WRITE_ONCE(cap->abort, true);
+	cancel_work_sync(&cap->work);
+	kvfree(cap->timestamps);
+	kvfree(cap->values);
+}
+
+static int asus_ec_capture_init(struct ec_sensors_data *ec)
+{
+	struct ec_capture *cap = &ec->capture;
+
+	mutex_init(&cap->lock);
+	INIT_WORK(&cap->work, asus_ec_capture_work);
+	init_completion(&cap->done);
+	complete_all(&cap->done);
+
+	return devm_add_action_or_reset(ec->dev, asus_ec_capture_cleanup, cap);
+}
+
+static int asus_ec_stats_show(struct seq_file *m, void *v)
+{
+	struct ec_sensors_data *ec = m->private;
+	struct ec_stats *stats = &ec->stats;
+
+	mutex_lock(&ec->update_lock);
+
+	seq_printf(m, "updates: %llu\n", stats->updates);
+	seq_printf(m, "update_errors: %llu\n", stats->update_errors);
+	seq_printf(m, "last_update_ns: %lld\n",
+		   ktime_to_ns(ec->last_sample_time));
+	if (sample_period_ms) {
+		seq_printf(m, "sampler_period_ms: %u\n", sample_period_ms);
+		seq_printf(m, "sampler_samples: %llu\n",
+			   stats->sampler_samples);
+		seq_printf(m, "sampler_missed: %llu\n",
+			   READ_ONCE(stats->sampler_missed));
+		seq_printf(m, "sampler_jitter_ns: min %lld avg %lld max %lld\n",
+			   stats->jitter_min_ns,
+			   stats->sampler_samples ?
+				div_s64(stats->jitter_sum_ns,
+					stats->sampler_samples) : 0,
+			   stats->jitter_max_ns);
+	}
+	seq_printf(m, "collisions: %llu\n", READ_ONCE(stats->collisions));
+	seq_printf(m, "slow_lock_waits: %llu\n",
+		   READ_ONCE(stats->slow_lock_waits));
+	seq_printf(m, "lock_wait_max_ns: %lld\n",
+		   READ_ONCE(stats->lock_wait_max_ns));
+	if (sample_period_ms && adaptive_phase) {
+		seq_printf(m, "phase_offset_ns: %lld\n",
+			   READ_ONCE(ec->sample_offset_ns));
+		seq_printf(m, "phase_shifts: %llu\n", ec->phase.shifts);
+		seq_printf(m, "collisions_initial_phase: %llu/%llu\n",
+			   ec->phase.initial_collisions,
+			   ec->phase.initial_samples);
+		seq_printf(m, "collisions_current_phase: %llu/%llu\n",
+			   ec->phase.current_collisions,
+			   ec->phase.current_samples);
+	}
+	seq_printf(m, "read_errors: %llu\n", stats->read_errors);
+	seq_printf(m, "read_retries: %llu\n", stats->read_retries);
+	seq_printf(m, "partial_updates: %llu\n", stats->partial_updates);
+	if (refresh_budget_us || ec_transactions_per_sec)
+		seq_printf(m, "truncated_updates: %llu\n",
+			   stats->truncated_updates);
+	if (ec_transactions_per_sec) {
+		seq_printf(m, "budget_per_sec: %u\n", ec_transactions_per_sec);
+		seq_printf(m, "budget_used: %llu\n", stats->budget_used);
+		seq_printf(m, "budget_deferrals: %llu\n",
+			   stats->budget_deferrals);
+	}
+
+	mutex_unlock(&ec->update_lock);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(asus_ec_stats);
+
+/* Per sensor state: age of the cached value and read errors */
+static int asus_ec_sensors_show(struct seq_file *m, void *v)
+{
+	struct ec_sensors_data *ec = m->private;
+	const struct ec_sensor_info *si;
+	ktime_t now = ktime_get();
+	struct ec_sensor *s;
+	unsigned int i;
+
+	mutex_lock(&ec->update_lock);
+
+	for (i = 0; i < ec->nr_sensors; i++) {
+		s = &ec->sensors[i];
+		si = get_sensor_info(ec, i);
+		seq_printf(m, "%s %s: ", sensor_type_names[si->type],
+			   si->label);
+		if (!is_sensor_active(s))
+			seq_puts(m, s->present ? "disabled" : "absent");
+		else if (!s->valid)
+			seq_puts(m, "invalid");
+		else
+			seq_printf(m, "%ld age_ms %lld",
+				   scale_sensor_value(s->cached_value,
+						      si->type),
+				   ktime_ms_delta(now, s->updated));
+		seq_printf(m, " errors %u", s->errors);
+		if (s->errors)
+			seq_printf(m, " last_error %d", s->last_error);
+		seq_putc(m, '\n');
+	}
 
-		state->last_updated = jiffies;
+	/* with the full 64-bit values, unlike the hwmon attributes */
+	for (i = 0; i < ec_derived_max; i++) {
+		if (!ec->derived[i].available)
+			continue;
+		seq_printf(m, "%s %s: ",
+			   sensor_type_names[derived_sensors_info[i].type],
+			   derived_sensors_info[i].label);
+		if (ec->derived[i].valid)
+			seq_printf(m, "%lld\n", ec->derived[i].value);
+		else
+			seq_puts(m, "invalid\n");
 	}
 
-	*value = state->sensors[sensor_index].cached_value;
+	mutex_unlock(&ec->update_lock);
 	return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(asus_ec_sensors);
 
 /*
- * Now follow the functions that implement the hwmon interface
+ * Moving averages of all the sensors, including those hwmon has no average
+ * attribute for.
  */
+static int asus_ec_averages_show(struct seq_file *m, void *v)
+{
+	struct ec_sensors_data *ec = m->private;
+	const struct ec_sensor_info *si;
+	struct ec_sensor *s;
+	unsigned int i;
 
-static int asus_ec_hwmon_read(struct device *dev, enum hwmon_sensor_types type,
-			      u32 attr, int channel, long *val)
+	mutex_lock(&ec->update_lock);
+
+	for (i = 0; i < ec->nr_sensors; i++) {
+		s = &ec->sensors[i];
+		if (!s->average_valid)
+			continue;
+		si = get_sensor_info(ec, i);
+		seq_printf(m, "%s %s: %ld\n", sensor_type_names[si->type],
+			   si->label,
+			   scale_sensor_value(get_sensor_average(s), si->type));
+	}
+
+	mutex_unlock(&ec->update_lock);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(asus_ec_averages);
+
+/*
+ * The history can take megabytes as text, hence it is dumped with an
+ * iterator taking the update lock for each chunk of the output. Samples
+ * added between the chunks are dumped as well, samples dropped from the
+ * ring before they were reached are skipped.
+ */
+enum history_section {
+	HISTORY_SENSOR,
+	HISTORY_RAW,
+	HISTORY_MINUTES,
+	HISTORY_MINUTE,
+	HISTORY_HOURS,
+	HISTORY_HOUR,
+};
+
+struct history_iter {
+	struct ec_sensors_data *ec;
+	loff_t index;
+	unsigned int sensor;
+	enum history_section section;
+	/* number of the raw sample or of the summary, counting from the first */
+	u64 nr;
+	/* the raw sample and the ring position of the next one */
+	unsigned int pos;
+	s64 time;
+	s32 value;
+};
+
+/* Number of the oldest summary still in the ring */
+static u64 history_first_summary(u32 nr, unsigned int size)
 {
-	int ret;
-	s32 value = 0;
+	return nr > size ? nr - size : 0;
+}
 
-	struct ec_sensors_data *state = dev_get_drvdata(dev);
-	int sidx = find_ec_sensor_index(state, type, channel);
+/* Decodes raw sample it->nr, restarting from the oldest one if it was dropped */
+static void history_iter_decode(struct history_iter *it,
+				const struct ec_history *h)
+{
+	if (it->nr <= h->first_raw) {
+		it->nr = h->first_raw;
+		it->pos = h->raw_tail;
+		it->time = h->base_time;
+		it->value = h->base_value;
+	}
+	if (it->nr < h->first_raw + h->nr_raw)
+		history_decode_raw(h, &it->pos, &it->time, &it->value);
+}
 
-	if (sidx < 0) {
-		return sidx;
+/* Skips the summaries overwritten since the iterator reached them */
+static void history_iter_revalidate(struct history_iter *it)
+{
+	const struct ec_history *h = &it->ec->history[it->sensor];
+
+	if (it->section == HISTORY_MINUTE)
+		it->nr = max(it->nr, history_first_summary(h->nr_minutes,
+							   ASUS_EC_HISTORY_MINUTES));
+	else if (it->section == HISTORY_HOUR)
+		it->nr = max(it->nr, history_first_summary(h->nr_hours,
+							   ASUS_EC_HISTORY_HOURS));
+}
+
+static void history_iter_step(struct history_iter *it)
+{
+	const struct ec_history *h = &it->ec->history[it->sensor];
+
+	switch (it->section) {
+	case HISTORY_SENSOR:
+		it->section = HISTORY_RAW;
+		it->nr = 0;
+		history_iter_decode(it, h);
+		break;
+	case HISTORY_RAW:
+		it->nr++;
+		history_iter_decode(it, h);
+		break;
+	case HISTORY_MINUTES:
+		it->section = HISTORY_MINUTE;
+		it->nr = history_first_summary(h->nr_minutes,
+					       ASUS_EC_HISTORY_MINUTES);
+		break;
+	case HISTORY_HOURS:
+		it->section = HISTORY_HOUR;
+		it->nr = history_first_summary(h->nr_hours,
+					       ASUS_EC_HISTORY_HOURS);
+		break;
+	case HISTORY_MINUTE:
+	case HISTORY_HOUR:
+		it->nr++;
+		history_iter_revalidate(it);
+		break;
 	}
+}
 
-	ret = get_cached_value_or_update(dev, sidx, state, &value);
-	if (!ret) {
-		*val = scale_sensor_value(value,
-					  get_sensor_info(state, sidx)->type);
+/* Moves past the exhausted sections, returns false at the end */
+static bool history_iter_settle(struct history_iter *it)
+{
+	const struct ec_history *h;
+
+	while (it->sensor < it->ec->nr_sensors) {
+		h = &it->ec->history[it->sensor];
+		switch (it->section) {
+		case HISTORY_SENSOR:
+			if (h->started)
+				return true;
+			it->sensor++;
+			break;
+		case HISTORY_RAW:
+			if (it->nr >= h->first_raw + h->nr_raw)
+				it->section = HISTORY_MINUTES;
+			return true;
+		case HISTORY_MINUTE:
+			if (it->nr >= h->nr_minutes)
+				it->section = HISTORY_HOURS;
+			return true;
+		case HISTORY_HOUR:
+			if (it->nr < h->nr_hours)
+				return true;
+			it->section = HISTORY_SENSOR;
+			it->sensor++;
+			break;
+		default:
+			return true;
+		}
 	}
 
-	return ret;
+	return false;
 }
 
-static int asus_ec_hwmon_read_string(struct device *dev,
-				     enum hwmon_sensor_types type, u32 attr,
-				     int channel, const char **str)
+static void *asus_ec_history_seq_start(struct seq_file *m, loff_t *pos)
 {
-	struct ec_sensors_data *state = dev_get_drvdata(dev);
-	int sensor_index = find_ec_sensor_index(state, type, channel);
-	*str = get_sensor_info(state, sensor_index)->label;
+	struct history_iter *it = m->private;
+	loff_t i;
+
+	mutex_lock(&it->ec->update_lock);
+
+	/* a new read or a seek, walk from the start */
+	if (!*pos || *pos != it->index) {
+		it->sensor = 0;
+		it->section = HISTORY_SENSOR;
+		for (i = 0; i < *pos; i++) {
+			if (!history_iter_settle(it))
+				return NULL;
+			history_iter_step(it);
+		}
+		it->index = *pos;
+	} else if (it->sensor < it->ec->nr_sensors) {
+		history_iter_revalidate(it);
+	}
 
-	return 0;
+	return history_iter_settle(it) ? it : NULL;
 }
 
-static umode_t asus_ec_hwmon_is_visible(const void *drvdata,
-					enum hwmon_sensor_types type, u32 attr,
-					int channel)
+static void *asus_ec_history_seq_next(struct seq_file *m, void *v, loff_t *pos)
 {
-	const struct ec_sensors_data *state = drvdata;
+	struct history_iter *it = v;
 
-	return find_ec_sensor_index(state, type, channel) >= 0 ? S_IRUGO : 0;
+	history_iter_step(it);
+	it->index = ++*pos;
+	return history_iter_settle(it) ? it : NULL;
 }
 
-static int
-asus_ec_hwmon_add_chan_info(struct hwmon_channel_info *asus_ec_hwmon_chan,
-			     struct device *dev, int num,
-			     enum hwmon_sensor_types type, u32 config)
+static void asus_ec_history_seq_stop(struct seq_file *m, void *v)
 {
-	int i;
-	u32 *cfg = devm_kcalloc(dev, num + 1, sizeof(*cfg), GFP_KERNEL);
+	struct history_iter *it = m->private;
 
-	if (!cfg)
-		return -ENOMEM;
+	mutex_unlock(&it->ec->update_lock);
+}
+
+static void history_show_summary(struct seq_file *m,
+				 const struct ec_history_summary *sum, int type)
+{
+	seq_printf(m, "%u %ld %ld %ld\n", sum->start,
+		   scale_sensor_value(sum->min, type),
+		   scale_sensor_value(sum->avg, type),
+		   scale_sensor_value(sum->max, type));
+}
 
-	asus_ec_hwmon_chan->type = type;
-	asus_ec_hwmon_chan->config = cfg;
-	for (i = 0; i < num; i++, cfg++)
-		*cfg = config;
+/*
+ * Dumps the whole history, oldest entries first and values in hwmon units:
+ * raw samples as "<ms since boot> <value>" and the minute and hour tiers as
+ * "<s since boot> <min> <avg> <max>".
+ */
+static int asus_ec_history_seq_show(struct seq_file *m, void *v)
+{
+	struct history_iter *it = v;
+	const struct ec_history *h = &it->ec->history[it->sensor];
+	const struct ec_sensor_info *si = get_sensor_info(it->ec, it->sensor);
+
+	switch (it->section) {
+	case HISTORY_SENSOR:
+		seq_printf(m, "%s %s\nraw:\n", sensor_type_names[si->type],
+			   si->label);
+		break;
+	case HISTORY_RAW:
+		seq_printf(m, "%lld %ld\n", it->time,
+			   scale_sensor_value(it->value, si->type));
+		break;
+	case HISTORY_MINUTES:
+		seq_puts(m, "minutes:\n");
+		break;
+	case HISTORY_MINUTE:
+		history_show_summary(m, &h->minutes[it->nr %
+						    ASUS_EC_HISTORY_MINUTES],
+				     si->type);
+		break;
+	case HISTORY_HOURS:
+		seq_puts(m, "hours:\n");
+		break;
+	case HISTORY_HOUR:
+		history_show_summary(m, &h->hours[it->nr % ASUS_EC_HISTORY_HOURS],
+				     si->type);
+		break;
+	}
 
 	return 0;
 }
 
-static const struct hwmon_ops asus_ec_hwmon_ops = {
-	.is_visible = asus_ec_hwmon_is_visible,
-	.read = asus_ec_hwmon_read,
-	.read_string = asus_ec_hwmon_read_string,
+static const struct seq_operations asus_ec_history_seq_ops = {
+	.start = asus_ec_history_seq_start,
+	.next = asus_ec_history_seq_next,
+	.stop = asus_ec_history_seq_stop,
+	.show = asus_ec_history_seq_show,
+};
+
+static int asus_ec_history_open(struct inode *inode, struct file *file)
+{
+	struct history_iter *it;
+
+	it = __seq_open_private(file, &asus_ec_history_seq_ops, sizeof(*it));
+	if (!it)
+		return -ENOMEM;
+
+	it->ec = inode->i_private;
+	return 0;
+}
+
+static const struct file_operations asus_ec_history_fops = {
+	.owner = THIS_MODULE,
+	.open = asus_ec_history_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = seq_release_private,
 };
 
-static struct hwmon_chip_info asus_ec_chip_info = {
-	.ops = &asus_ec_hwmon_ops,
+/*
+ * A line per sensor with the non-empty buckets as
+ * "<bucket lower bound>:<count>", the bound in hwmon units.
+ */
+static int asus_ec_histograms_show(struct seq_file *m, void *v)
+{
+	struct ec_sensors_data *ec = m->private;
+	const struct ec_sensor_info *si;
+	unsigned int i, j;
+	u32 count;
+
+	mutex_lock(&ec->update_lock);
+
+	for (i = 0; i < ec->nr_sensors; i++) {
+		si = get_sensor_info(ec, i);
+		seq_printf(m, "%s %s", sensor_type_names[si->type], si->label);
+		for (j = 0; j < ASUS_EC_HISTOGRAM_BUCKETS; j++) {
+			count = ec->histograms[i][j];
+			if (count)
+				seq_printf(m, " %ld:%u",
+					   scale_sensor_value(histogram_ranges[si->type].low +
+							      j * histogram_ranges[si->type].width,
+							      si->type),
+					   count);
+		}
+		seq_putc(m, '\n');
+	}
+
+	mutex_unlock(&ec->update_lock);
+	return 0;
+}
+
+static int asus_ec_histograms_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, asus_ec_histograms_show, inode->i_private);
+}
+
+/* Writing "reset" clears all the histograms */
+static ssize_t asus_ec_histograms_write(struct file *file,
+					const char __user *user_buf,
+					size_t count, loff_t *ppos)
+{
+	struct seq_file *m = file->private_data;
+	struct ec_sensors_data *ec = m->private;
+	char buf[16];
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, user_buf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+
+	if (!sysfs_streq(buf, "reset"))
+		return -EINVAL;
+
+	mutex_lock(&ec->update_lock);
+	memset(ec->histograms, 0, ec->nr_sensors * sizeof(*ec->histograms));
+	mutex_unlock(&ec->update_lock);
+	return count;
+}
+
+static const struct file_operations asus_ec_histograms_fops = {
+	.owner = THIS_MODULE,
+	.open = asus_ec_histograms_open,
+	.read = seq_read,
+	.write = asus_ec_histograms_write,
+	.llseek = seq_lseek,
+	.release = single_release,
 };
 
+static void asus_ec_debugfs_remove(void *data)
+{
+	struct ec_sensors_data *ec = data;
+
+	debugfs_remove_recursive(ec->debugfs);
+}
+
+static int asus_ec_debugfs_init(struct ec_sensors_data *ec)
+{
+	ec->debugfs = debugfs_create_dir(dev_name(ec->dev), NULL);
+
+	debugfs_create_file("capture", 0600, ec->debugfs, ec,
+			    &asus_ec_capture_fops);
+	debugfs_create_file("stats", 0400, ec->debugfs, ec,
+			    &asus_ec_stats_fops);
+	debugfs_create_file("sensors", 0400, ec->debugfs, ec,
+			    &asus_ec_sensors_fops);
+	if (average_shift)
+		debugfs_create_file("averages", 0400, ec->debugfs, ec,
+				    &asus_ec_averages_fops);
+	if (ec->history)
+		debugfs_create_file("history", 0400, ec->debugfs, ec,
+				    &asus_ec_history_fops);
+	if (ec->histograms)
+		debugfs_create_file("histograms", 0600, ec->debugfs, ec,
+				    &asus_ec_histograms_fops);
+
+	return devm_add_action_or_reset(ec->dev, asus_ec_debugfs_remove, ec);
+}
+
 static const struct ec_board_info *get_board_info(void)
 {
 	const struct dmi_system_id *dmi_entry;
@@ -968,58 +4580,48 @@ static const struct ec_board_info *get_board_info(void)
 
 static int asus_ec_probe(struct platform_device *pdev)
 {
-	const struct hwmon_channel_info **ptr_asus_ec_ci;
-	int nr_count[hwmon_max] = { 0 }, nr_types = 0;
-	struct hwmon_channel_info *asus_ec_hwmon_chan;
 	const struct ec_board_info *pboard_info;
-	const struct hwmon_chip_info *chip_info;
 	struct device *dev = &pdev->dev;
 	struct ec_sensors_data *ec_data;
-	const struct ec_sensor_info *si;
-	enum hwmon_sensor_types type;
+	unsigned int nr_absent;
 	struct device *hwdev;
-	unsigned int i;
 	int status;
 
+	BUILD_BUG_ON(ASUS_EC_MAX_SENSORS > BITS_PER_LONG);
+
 	pboard_info = get_board_info();
 	if (!pboard_info)
 		return -ENODEV;
 
+	if (average_shift > ASUS_EC_MAX_AVERAGE_SHIFT) {
+		dev_err(dev, "average_shift can't exceed %d\n",
+			ASUS_EC_MAX_AVERAGE_SHIFT);
+		return -EINVAL;
+	}
+
+	if (history_bytes && (history_bytes < ASUS_EC_HISTORY_MIN_BYTES ||
+			      history_bytes > ASUS_EC_HISTORY_MAX_BYTES)) {
+		dev_err(dev, "history_bytes has to be between %d and %d\n",
+			ASUS_EC_HISTORY_MIN_BYTES, ASUS_EC_HISTORY_MAX_BYTES);
+		return -EINVAL;
+	}
+
 	ec_data = devm_kzalloc(dev, sizeof(struct ec_sensors_data),
 			       GFP_KERNEL);
 	if (!ec_data)
 		return -ENOMEM;
 
 	dev_set_drvdata(dev, ec_data);
+	ec_data->dev = dev;
 	ec_data->board_info = pboard_info;
+	mutex_init(&ec_data->update_lock);
+	seqcount_latch_init(&ec_data->snapshot_seq);
+	INIT_LIST_HEAD(&ec_data->block_requests);
+	ec_data->budget_tokens = (u64)ec_transactions_per_sec * NSEC_PER_SEC;
+	ec_data->budget_updated = ktime_get();
 
-	switch (ec_data->board_info->family) {
-	case family_amd_400_series:
-		ec_data->sensors_info = sensors_family_amd_400;
-		break;
-	case family_amd_500_series:
-		ec_data->sensors_info = sensors_family_amd_500;
-		break;
-	case family_amd_600_series:
-		ec_data->sensors_info = sensors_family_amd_600;
-		break;
-	case family_intel_300_series:
-		ec_data->sensors_info = sensors_family_intel_300;
-		break;
-	case family_intel_600_series:
-		ec_data->sensors_info = sensors_family_intel_600;
-		break;
-	default:
-		dev_err(dev, "Unknown board family: %d",
-			ec_data->board_info->family);
-		return -EINVAL;
-	}
-
+	ec_data->sensors_info = ec_data->board_info->sensors_info;
 	ec_data->nr_sensors = hweight_long(ec_data->board_info->sensors);
-	ec_data->sensors = devm_kcalloc(dev, ec_data->nr_sensors,
-					sizeof(struct ec_sensor), GFP_KERNEL);
-	if (!ec_data->sensors)
-		return -ENOMEM;
 
 	status = setup_lock_data(dev);
 	if (status) {
@@ -1028,56 +4630,110 @@ static int asus_ec_probe(struct platform_device *pdev)
 	}
 
 	setup_sensor_data(ec_data);
-	ec_data->registers = devm_kcalloc(dev, ec_data->nr_registers,
-					  sizeof(u16), GFP_KERNEL);
-	ec_data->read_buffer = devm_kcalloc(dev, ec_data->nr_registers,
-					    sizeof(u8), GFP_KERNEL);
+	if (derived_sensors)
+		setup_derived_data(ec_data);
 
-	if (!ec_data->registers || !ec_data->read_buffer)
-		return -ENOMEM;
+	if (history_bytes) {
+		status = asus_ec_history_init(ec_data);
+		if (status)
+			return status;
+	}
 
-	fill_ec_registers(ec_data);
+	if (histograms) {
+		ec_data->histograms = devm_kcalloc(dev, ec_data->nr_sensors,
+						   sizeof(*ec_data->histograms),
+						   GFP_KERNEL);
+		if (!ec_data->histograms)
+			return -ENOMEM;
+	}
 
-	for (i = 0; i < ec_data->nr_sensors; ++i) {
-		si = get_sensor_info(ec_data, i);
-		if (!nr_count[si->type])
-			++nr_types;
-		++nr_count[si->type];
+	status = setup_regmap(ec_data);
+	if (status) {
+		dev_err(dev, "Failed to setup EC register map: %d", status);
+		return status;
 	}
 
-	if (nr_count[hwmon_temp])
-		nr_count[hwmon_chip]++, nr_types++;
+	if (lock_benchmark_loops)
+		benchmark_locks(dev, lock_benchmark_loops);
+
+	setup_read_plan(ec_data);
+
+	if (detect_absent_sensors) {
+		nr_absent = detect_sensor_presence(ec_data);
+		if (nr_absent) {
+			dev_info(dev, "%u EC sensors look unconnected",
+				 nr_absent);
+			status = devm_delayed_work_autocancel(dev,
+							      &ec_data->presence_work,
+							      asus_ec_presence_work);
+			if (status)
+				return status;
+			if (presence_recheck_interval)
+				schedule_delayed_work(&ec_data->presence_work,
+						      presence_recheck_interval * HZ);
+		}
+	}
 
-	asus_ec_hwmon_chan = devm_kcalloc(
-		dev, nr_types, sizeof(*asus_ec_hwmon_chan), GFP_KERNEL);
-	if (!asus_ec_hwmon_chan)
-		return -ENOMEM;
+	/* the driver registers its own thermal zones if asked to */
+	ec_data->chip_info.ops = &asus_ec_hwmon_ops;
+	ec_data->chip_info.info = pboard_info->hwmon_info + (thermal_zones ? 1 : 0);
 
-	ptr_asus_ec_ci = devm_kcalloc(dev, nr_types + 1,
-				       sizeof(*ptr_asus_ec_ci), GFP_KERNEL);
-	if (!ptr_asus_ec_ci)
-		return -ENOMEM;
+	dev_info(dev, "board has %d EC sensors that span %d registers",
+		 ec_data->nr_sensors, pboard_info->nr_registers);
 
-	asus_ec_chip_info.info = ptr_asus_ec_ci;
-	chip_info = &asus_ec_chip_info;
+	hwdev = devm_hwmon_device_register_with_info(dev, "asusec", ec_data,
+						     &ec_data->chip_info, NULL);
+	if (IS_ERR(hwdev))
+		return PTR_ERR(hwdev);
 
-	for (type = 0; type < hwmon_max; ++type) {
-		if (!nr_count[type])
-			continue;
+	status = asus_ec_capture_init(ec_data);
+	if (status)
+		return status;
 
-		asus_ec_hwmon_add_chan_info(asus_ec_hwmon_chan, dev,
-					     nr_count[type], type,
-					     hwmon_attributes[type]);
-		*ptr_asus_ec_ci++ = asus_ec_hwmon_chan++;
+	if (sample_period_ms) {
+		status = asus_ec_sampler_start(ec_data, sample_period_ms);
+		if (status)
+			return status;
 	}
 
-	dev_info(dev, "board has %d EC sensors that span %d registers",
-		 ec_data->nr_sensors, ec_data->nr_registers);
+	status = asus_ec_debugfs_init(ec_data);
+	if (status)
+		return status;
+
+	if (enable_iio) {
+		status = asus_ec_iio_register(ec_data);
+		if (status) {
+			dev_err(dev, "Failed to register IIO device: %d",
+				status);
+			return status;
+		}
+	}
+
+	status = asus_ec_instance_attach(ec_data);
+	if (status == -EBUSY)
+		dev_warn(dev, "Another device serves the exported interfaces");
+	else if (status)
+		return status;
+
+	/* the PMU name is global as well */
+	if (perf_pmu && ec_data->exported) {
+		status = asus_ec_pmu_register(ec_data);
+		if (status) {
+			dev_err(dev, "Failed to register perf PMU: %d", status);
+			return status;
+		}
+	}
 
-	hwdev = devm_hwmon_device_register_with_info(dev, "asusec",
-						     ec_data, chip_info, NULL);
+	if (thermal_zones && nr_channels(ec_data, hwmon_temp)) {
+		status = asus_ec_thermal_register(ec_data);
+		if (status) {
+			dev_err(dev, "Failed to register thermal zones: %d",
+				status);
+			return status;
+		}
+	}
 
-	return PTR_ERR_OR_ZERO(hwdev);
+	return 0;
 }
 
 MODULE_DEVICE_TABLE(dmi, dmi_table);
@@ -1093,12 +4749,27 @@ static struct platform_device *asus_ec_sensors_platform_device;
 
 static int __init asus_ec_init(void)
 {
+	int status;
+
+	/* not fatal, the kfunc and netlink are optional interfaces */
+	status = asus_ec_bpf_init();
+	if (status)
+		pr_warn("asus-ec-sensors: failed to register BPF kfuncs: %d\n",
+			status);
+
+	status = asus_ec_genl_init();
+	if (status)
+		pr_warn("asus-ec-sensors: failed to register netlink family: %d\n",
+			status);
+
 	asus_ec_sensors_platform_device =
 		platform_create_bundle(&asus_ec_sensors_platform_driver,
 				       asus_ec_probe, NULL, 0, NULL, 0);
 
-	if (IS_ERR(asus_ec_sensors_platform_device))
+	if (IS_ERR(asus_ec_sensors_platform_device)) {
+		asus_ec_genl_exit();
 		return PTR_ERR(asus_ec_sensors_platform_device);
+	}
 
 	return 0;
 }
@@ -1107,6 +4778,7 @@ static void __exit asus_ec_exit(void)
 {
 	platform_device_unregister(asus_ec_sensors_platform_device);
 	platform_driver_unregister(&asus_ec_sensors_platform_driver);
+	asus_ec_genl_exit();
 }
 
 module_init(asus_ec_init);
@@ -1116,6 +4788,78 @@ module_param_named(mutex_path, mutex_path_override, charp, 0);
 MODULE_PARM_DESC(mutex_path,
 		 "Override ACPI mutex path used to guard access to hardware");
 
+module_param(release_lock_per_bank, bool, 0);
+MODULE_PARM_DESC(release_lock_per_bank,
+		 "Release the hardware lock after reading each register bank");
+
+module_param_named(lock_benchmark, lock_benchmark_loops, uint, 0);
+MODULE_PARM_DESC(lock_benchmark,
+		 "Measure lock acquisition cost at probe time over that many iterations");
+
+module_param(detect_absent_sensors, bool, 0);
+MODULE_PARM_DESC(detect_absent_sensors,
+		 "Do not read sensors that look unconnected at probe time");
+
+module_param(presence_recheck_interval, uint, 0);
+MODULE_PARM_DESC(presence_recheck_interval,
+		 "Interval in seconds to re-check unconnected sensors, 0 to disable");
+
+module_param(enabled_sensors, ulong, 0);
+MODULE_PARM_DESC(enabled_sensors,
+		 "Bit mask of sensors to read initially, bit numbers follow enum ec_sensors");
+
+module_param(enable_iio, bool, 0);
+MODULE_PARM_DESC(enable_iio,
+		 "Register an IIO device with a triggered buffer for sampling");
+
+module_param(sample_period_ms, uint, 0);
+MODULE_PARM_DESC(sample_period_ms,
+		 "Read sensors at this fixed period instead of on demand, 0 to disable");
+
+module_param(derived_sensors, bool, 0);
+MODULE_PARM_DESC(derived_sensors,
+		 "Publish CPU power and energy and water temperature delta computed from EC sensors");
+
+module_param(average_shift, uint, 0);
+MODULE_PARM_DESC(average_shift,
+		 "Weight of a new sample in sensor moving averages is 1/2^N, 0 to disable averaging");
+
+module_param(history_bytes, uint, 0);
+MODULE_PARM_DESC(history_bytes,
+		 "Per sensor buffer size for raw sample history, 2-3 bytes per sample, 0 to disable history");
+
+module_param(histograms, bool, 0);
+MODULE_PARM_DESC(histograms,
+		 "Count sensor values in fixed-bucket histograms, shown in debugfs");
+
+module_param(thermal_zones, bool, 0);
+MODULE_PARM_DESC(thermal_zones,
+		 "Register a thermal zone per temperature sensor instead of via hwmon, the zones report the values of the fixed-rate sampler (sample_period_ms) or other readers");
+
+module_param_array(thermal_trips, int, &nr_thermal_trips, 0);
+MODULE_PARM_DESC(thermal_trips,
+		 "Passive trip points of the thermal zones, in millidegrees Celsius");
+
+module_param(thermal_polling_ms, uint, 0);
+MODULE_PARM_DESC(thermal_polling_ms,
+		 "Thermal zone polling delay, 0 to rely on updates from sensor refreshes");
+
+module_param(perf_pmu, bool, 0);
+MODULE_PARM_DESC(perf_pmu,
+		 "Register the asus_ec perf PMU with an event per sensor");
+
+module_param(ec_transactions_per_sec, uint, 0);
+MODULE_PARM_DESC(ec_transactions_per_sec,
+		 "Limit EC transactions per second of sensor refreshes and reads for other drivers, 0 for no limit. Presence detection at probe is charged but not limited, burst capture is exempt");
+
+module_param(refresh_budget_us, uint, 0);
+MODULE_PARM_DESC(refresh_budget_us,
+		 "Stop a refresh after the bank being read when it takes longer [us], the next refresh resumes from there, 0 for no limit");
+
+module_param(adaptive_phase, bool, 0);
+MODULE_PARM_DESC(adaptive_phase,
+		 "Shift fixed-rate sampling away from firmware EC accesses");
+
 MODULE_AUTHOR("Eugene Shalygin <eugene.shalygin@gmail.com>");
 MODULE_DESCRIPTION(
 	"HWMON driver for sensors accessible via ACPI EC in ASUS motherboards");
@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: GPL-2.0+ */
+/*
+ * Interface of the asus-ec-sensors driver for other kernel modules.
+ */
+
+#ifndef _ASUS_EC_SENSORS_H
+#define _ASUS_EC_SENSORS_H
+
+#include <linux/notifier.h>
+#include <linux/types.h>
+
+/* Sensor ids, indices of the snapshot values */
+enum asus_ec_sensor {
+	/* chipset temperature [℃] */
+	ASUS_EC_SENSOR_TEMP_CHIPSET,
+	/* CPU temperature [℃] */
+	ASUS_EC_SENSOR_TEMP_CPU,
+	/* CPU package temperature [℃] */
+	ASUS_EC_SENSOR_TEMP_CPU_PACKAGE,
+	/* motherboard temperature [℃] */
+	ASUS_EC_SENSOR_TEMP_MB,
+	/* "T_Sensor" temperature sensor reading [℃] */
+	ASUS_EC_SENSOR_TEMP_T_SENSOR,
+	/* VRM temperature [℃] */
+	ASUS_EC_SENSOR_TEMP_VRM,
+	/* CPU Core voltage [mV] */
+	ASUS_EC_SENSOR_IN_CPU_CORE,
+	/* CPU_Opt fan [RPM] */
+	ASUS_EC_SENSOR_FAN_CPU_OPT,
+	/* VRM heat sink fan [RPM] */
+	ASUS_EC_SENSOR_FAN_VRM_HS,
+	/* Chipset fan [RPM] */
+	ASUS_EC_SENSOR_FAN_CHIPSET,
+	/* Water flow sensor reading [RPM] */
+	ASUS_EC_SENSOR_FAN_WATER_FLOW,
+	/* CPU current [A] */
+	ASUS_EC_SENSOR_CURR_CPU,
+	/* "Water_In" temperature sensor reading [℃] */
+	ASUS_EC_SENSOR_TEMP_WATER_IN,
+	/* "Water_Out" temperature sensor reading [℃] */
+	ASUS_EC_SENSOR_TEMP_WATER_OUT,
+	/* "Water_Block_In" temperature sensor reading [℃] */
+	ASUS_EC_SENSOR_TEMP_WATER_BLOCK_IN,
+	/* "Water_Block_Out" temperature sensor reading [℃] */
+	ASUS_EC_SENSOR_TEMP_WATER_BLOCK_OUT,
+	/* "T_sensor_2" temperature sensor reading [℃] */
+	ASUS_EC_SENSOR_TEMP_T_SENSOR_2,
+	/* "Extra_1" temperature sensor reading [℃] */
+	ASUS_EC_SENSOR_TEMP_SENSOR_EXTRA_1,
+	/* "Extra_2" temperature sensor reading [℃] */
+	ASUS_EC_SENSOR_TEMP_SENSOR_EXTRA_2,
+	/* "Extra_3" temperature sensor reading [℃] */
+	ASUS_EC_SENSOR_TEMP_SENSOR_EXTRA_3,
+	/* number of known sensors, keep last */
+	ASUS_EC_SENSOR_MAX,
+};
+
+/*
+ * Decoded values of all the sensors from a single refresh, in hwmon units
+ * (m℃, mV, mA, RPM) and indexed by enum asus_ec_sensor.
+ */
+struct asus_ec_snapshot {
+	/* monotonic time of the refresh [ns] */
+	u64 timestamp;
+	/* bit per sensor with a value */
+	u64 valid;
+	s32 values[ASUS_EC_SENSOR_MAX];
+	/*
+	 * monotonic time each value was read at [ns], that is when the read
+	 * of its bank finished, earlier than the timestamp for the sensors a
+	 * refresh did not get to or failed to read
+	 */
+	u64 read_times[ASUS_EC_SENSOR_MAX];
+};
+
+/* Action passed to the snapshot notifiers */
+#define ASUS_EC_SNAPSHOT_UPDATED	1
+
+int asus_ec_get_snapshot(struct asus_ec_snapshot *snap);
+int asus_ec_register_snapshot_notifier(struct notifier_block *nb);
+int asus_ec_unregister_snapshot_notifier(struct notifier_block *nb);
+
+int asus_ec_read_block(u8 bank, u8 start, u8 len, u8 *buf);
+int asus_ec_read_block_batched(u8 bank, u8 start, u8 len, u8 *buf);
+
+#endif /* _ASUS_EC_SENSORS_H */